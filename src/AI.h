@@ -1,41 +1,264 @@
 #pragma once
 
-#include <mutex>
 #include <algorithm>
+#include <cassert>
 #include <string>
+#include <vector>
+#include <limits>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <future>
+#include <span>
+#include <stop_token>
+#include <random>
+#include <optional>
 
 #include <raylib.h>
 
 #include "Vec2.h"
+#include "Position.h"
+#include "Evaluation.h"
+#include "TranspositionTable.h"
+#include "ThreadPool.h"
+#include "StaticExchange.h"
+#include "MoveOrdering.h"
+#include "MoveList.h"
+#include "SearchStats.h"
+#include "Tablebase.h"
+#include "OpeningBook.h"
 
 namespace ai
 {
-    uint64_t nodesGenerated = 0;
+    // Shared by every search, so results carry over between iterations and moves
+    inline tt::TranspositionTable transpositionTable;
+
+    // When set, every search is repeated with the plain minimax to the same depth to report the node reduction
+    inline bool compareWithMiniMax = false;
+
+    // Number of threads searching each move. Helpers share the transposition table with the main thread
+    inline int threadCount = 1;
+
+    // Order quiet moves by killer, counter-move and history heuristics instead of generation order
+    inline bool useOrderingHeuristics = true;
+
+    // Generate the moves of a node a group at a time, in the order they're searched, instead of all up front
+    inline bool useStagedMoveGeneration = true;
+
+    // Selective pruning, each of which can be switched off to measure what it saves and costs
+    struct Pruning
+    {
+        bool nullMove = true;
+        bool lateMoveReductions = true;
+        bool futility = true;
+        bool razoring = true;
+    };
+
+    inline Pruning pruning;
+
+    // Pin the engine's pool workers to cores
+    inline bool pinThreads = false;
+
+    // Search the predicted reply while the player is thinking
+    inline bool ponder = true;
+
+    // Print the statistics of every search the ai makes
+    inline bool printStats = false;
+
+    // Runs every search and background job. Created on first use with at least one worker per search thread
+    inline ThreadPool& threadPool()
+    {
+        static ThreadPool pool( std::max( std::thread::hardware_concurrency(), static_cast< unsigned >( threadCount ) ), pinThreads );
+
+        return pool;
+    }
 
     enum Difficulty
     {
-        Easy     = 1,
-        Medium   = 2,
-        Hard     = 3,
-        VeryHard = 4,
-        Crazy    = 5
+        Easy,
+        Medium,
+        Hard,
+        VeryHard,
+        Crazy
+    };
+
+    // Whichever budget runs out first ends the search. A node budget or depth of 0 means unlimited
+    struct Limits
+    {
+        double seconds;
+        uint64_t nodes = 0;
+        int depth = 0;
+    };
+
+    constexpr std::array DifficultyLimits = {
+        Limits{ 0.1, 2'000 },  // Easy
+        Limits{ 0.25, 20'000 }, // Medium
+        Limits{ 1.0 },          // Hard
+        Limits{ 2.5 },          // VeryHard
+        Limits{ 5.0 },          // Crazy
     };
 
+    constexpr Limits getLimits( Difficulty d )
+    {
+        return DifficultyLimits[ static_cast< uint8_t >( d ) ];
+    }
+
     struct Move
     {
         Vec2 from;
         Vec2 dst;
+        // what a pawn reaching the last row becomes
+        piece::Type promotion = piece::Type::Null;
+
+        constexpr bool operator==( Move const& ) const = default;
+    };
+
+    inline std::ostream& operator<<( std::ostream& os, Move m )
+    {
+        os << m.from << "->" << m.dst;
+
+        if ( m.promotion != piece::Type::Null )
+            os << "=" << "KQBNRP"[ m.promotion ];
+
+        return os;
+    }
+
+    /*
+        Steers a search started on the player's time. The clock doesn't run while pondering; once the
+        guess is confirmed the search carries on with the time it has already spent counted against it.
+    */
+    struct Ponder
+    {
+        std::atomic< bool > pondering = true;
     };
 
-    struct Result
+    struct SearchResult
     {
         Move move;
-        bool ready = false;
+        int score = 0;
+        int depth = 0;
+        uint64_t nodes = 0;
+        double seconds = 0;
+        stats::Search stats;
+        // the expected line of play, starting with move
+        std::vector< Move > pv;
     };
 
     namespace details
     {
-        constexpr int MaxDepth = 5;
+        constexpr int MaxDepth = 64;
+
+        // Bounds how long a search takes to notice it has been stopped: a quarter of a millisecond at a million nodes per second
+        constexpr uint64_t NodesBetweenStopChecks = 256;
+
+        // Each thread publishes its node count in its own cache line, so counting never contends
+        struct alignas( 64 ) NodeCounter
+        {
+            std::atomic< uint64_t > nodes = 0;
+        };
+
+        // State shared by all threads searching the same move
+        struct SharedSearch
+        {
+            std::chrono::steady_clock::time_point start;
+            std::chrono::steady_clock::time_point deadline;
+            uint64_t maxNodes = 0;
+            std::atomic< bool > stop = false;
+            std::vector< NodeCounter > counters;
+            // set by whoever no longer wants the result
+            std::stop_token stopToken;
+            Ponder const* ponder = nullptr;
+
+            SharedSearch( Limits limits, int threads, std::stop_token stopToken, Ponder const* ponder ):
+                start( std::chrono::steady_clock::now() ),
+                deadline( start + std::chrono::duration_cast< std::chrono::steady_clock::duration >( std::chrono::duration< double >( limits.seconds ) ) ),
+                maxNodes( limits.nodes ),
+                counters( threads ),
+                stopToken( std::move( stopToken ) ),
+                ponder( ponder ) {}
+
+            bool isPondering() const
+            {
+                return ponder && ponder->pondering.load( std::memory_order_relaxed );
+            }
+
+            double elapsed() const
+            {
+                return std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+            }
+
+            uint64_t totalNodes() const
+            {
+                uint64_t total = 0;
+
+                for ( auto const& c : counters )
+                {
+                    total += c.nodes.load( std::memory_order_relaxed );
+                }
+
+                return total;
+            }
+        };
+
+        // Per-thread search state
+        struct SearchContext
+        {
+            SharedSearch& shared;
+            NodeCounter& counter;
+            uint64_t nodes = 0;
+            ordering::Heuristics heuristics;
+            stats::Search stats;
+            // the iteration of iterative deepening being searched, to file the node counts under
+            int iteration = 0;
+            // the move made at each ply, to look up counter moves
+            std::array< PackedMove, ordering::MaxPly > moveStack{};
+            // triangular table: row ply holds the principal variation from ply onwards, pvLength[ ply ] long
+            std::array< std::array< PackedMove, ordering::MaxPly >, ordering::MaxPly > pvTable;
+            std::array< int, ordering::MaxPly > pvLength{};
+            // the main thread always completes its first iteration so there is a move to return
+            bool canStop = false;
+            bool stopped = false;
+
+            SearchContext( SharedSearch& shared, int threadIndex ):
+                shared( shared ),
+                counter( shared.counters[ threadIndex ] ),
+                canStop( threadIndex != 0 ) {}
+
+            // Called once per node; only publishes the node count and looks at the clock every NodesBetweenStopChecks nodes
+            bool shouldStop()
+            {
+                nodes += 1;
+
+                if ( nodes % NodesBetweenStopChecks == 0 )
+                {
+                    counter.nodes.store( nodes, std::memory_order_relaxed );
+
+                    auto const outOfNodes = shared.maxNodes != 0 && shared.totalNodes() >= shared.maxNodes;
+                    auto const outOfTime = !shared.isPondering() && std::chrono::steady_clock::now() >= shared.deadline;
+
+                    if ( canStop && ( outOfNodes || outOfTime ) )
+                    {
+                        shared.stop.store( true, std::memory_order_relaxed );
+                    }
+
+                    // nobody wants the result of a cancelled search, so even the first iteration is abandoned
+                    if ( shared.stopToken.stop_requested() )
+                    {
+                        canStop = true;
+                        shared.stop.store( true, std::memory_order_relaxed );
+                    }
+                }
+
+                stopped = canStop && shared.stop.load( std::memory_order_relaxed );
+
+                return stopped;
+            }
+
+            void publishNodes()
+            {
+                counter.nodes.store( nodes, std::memory_order_relaxed );
+            }
+        };
 
         constexpr std::array takePieceScores = {
             50000, // king
@@ -51,7 +274,7 @@ namespace ai
 
         constexpr int PromotedToQueen = 40;
 
-        constexpr getPieceScore( piece::Type t )
+        constexpr int getPieceScore( piece::Type t )
         {
             return takePieceScores[ static_cast< uint8_t >( t ) ];
         }
@@ -70,7 +293,7 @@ namespace ai
         };
 
         template< class Fn >
-        void forAllLegalMoves( Piece* board, Piece pieceToMove, Vec2 coords, int depth, bool isMaximizing, Fn fn )
+        void forAllLegalMoves( Piece* board, Piece pieceToMove, Vec2 coords, int depth, bool isMaximizing, int16_t enPassant, Fn fn )
         {
             auto const pieceToMoveIndex = board::coordsToIndex( coords );
 
@@ -88,7 +311,7 @@ namespace ai
                     {
                         fn( board, pieceToMoveIndex, potentialMoveIdx, depth, isMaximizing );
 
-                        if ( board::isPawnStartingPosition( pieceToMoveIndex ) )
+                        if ( board::isPawnStartingPosition( pieceToMoveIndex, isMaximizing ) )
                         {
                             auto const potentialDblMoveCoords = coords + direction + direction;
                             auto const potentialDblMoveIdx = board::coordsToIndex( potentialDblMoveCoords );
@@ -121,7 +344,7 @@ namespace ai
                     auto const pieceToMoveToIsEnemy = !pieceToMoveTo.isNull() && isMaximizing ?
                                                             pieceToMoveTo.isUser()
                                                           : pieceToMoveTo.isAi();
-                    if ( pieceToMoveToIsEnemy )
+                    if ( pieceToMoveToIsEnemy || potentialMoveIdx == enPassant )
                     {
                         fn( board, pieceToMoveIndex, potentialMoveIdx, depth, isMaximizing );
                     }
@@ -163,120 +386,1493 @@ namespace ai
             }
         }
 
-        template< class RetTy = int >
-        RetTy miniMax( Piece* board, int depth, bool isMaximizing )
-        {            
-            MoveAndScore bestMove( isMaximizing );
+        constexpr int Infinity = 1'000'000;
 
-            for ( int16_t j = 0; j < 8; ++j )
+        // Being mated at the root. Each ply further from the root scores one better, so the quickest mate is played
+        constexpr int MateScore = 40'000;
+        // Scores beyond this either way are mates, above anything the tablebases say
+        constexpr int MateBound = MateScore - 1'000;
+
+        // Mates are stored in the hash table counted from the node rather than the root, as the node can come up at any ply
+        constexpr int toHashScore( int score, int ply )
+        {
+            return score > MateBound ? score + ply : score < -MateBound ? score - ply : score;
+        }
+
+        constexpr int fromHashScore( int score, int ply )
+        {
+            return score > MateBound ? score - ply : score < -MateBound ? score + ply : score;
+        }
+
+        // quiet moves are ordered below captures by ordering::Heuristics
+        constexpr int PromotionOrder = 1 << 28;
+        constexpr int CaptureOrder   = 1 << 26;
+
+        // Packs a move that is about to be made on board, which is where its flags come from. A pawn reaching the last row becomes promotion
+        constexpr PackedMove makePackedMove( Piece const* board, int16_t from, int16_t dst, piece::Type promotion = piece::Type::Queen )
+        {
+            auto const isCapture = !board[ dst ].isNull() || board::isEnPassant( board, from, dst );
+
+            return { from, dst, isCapture, board::isPromotion( board, from, dst ) ? promotion : piece::Type::Null };
+        }
+
+        // Promotions to a queen first, then captures by most valuable victim / least valuable attacker, then quiet moves
+        constexpr int getMoveOrder( Piece const* board, PackedMove move )
+        {
+            int order = 0;
+
+            if ( move.promotion() == piece::Type::Queen )
             {
-                for ( int16_t i = 0; i < 8; ++i )
-                {
-                    auto const coords = Vec2{ i, j };
-                    auto const index = board::coordsToIndex( coords );
-                    auto const piece = board[ index ];
+                order += PromotionOrder;
+            }
 
-                    if ( piece.isNull() )
-                        continue;
+            if ( move.isCapture() )
+            {
+                auto const attackerScore = std::min( getPieceScore( board[ move.from() ].type ), 63 );
+                // only en passant captures onto an empty square
+                auto const victim = board[ move.dst() ].isNull() ? piece::Type::Pawn : board[ move.dst() ].type;
+
+                order += CaptureOrder + getPieceScore( victim ) * 64 + 64 - attackerScore;
+            }
 
-                    auto const pieceIsSelf = isMaximizing == piece.isAi();
+            return order;
+        }
 
-                    if ( !pieceIsSelf )
-                        continue;
+        enum class MoveKinds
+        {
+            All,
+            // captures and promotions to a queen
+            Captures,
+            // everything else, promotions to the other pieces included
+            Quiets
+        };
 
-                    forAllLegalMoves( board, piece, { i, j }, depth, isMaximizing,
-                        [&bestMove]( Piece* board, int16_t from, int16_t dst, int depth, bool isMaximizing )
-                        {
-                            nodesGenerated += 1;
+        constexpr bool isCaptureKind( PackedMove m )
+        {
+            return m.isCapture() || m.promotion() == piece::Type::Queen;
+        }
 
-                            // make move
-                            auto [fromB4, dstB4, promotedToQueen] = board::movePiece( board, from, dst );
+        // What a pawn can promote to, the queen first
+        constexpr std::array Promotions = { piece::Type::Queen, piece::Type::Knight, piece::Type::Rook, piece::Type::Bishop };
 
-                            auto score = getPieceScore( dstB4.type ) * ( isMaximizing ? 1 : -1 );
+        /*
+            Appends the moves of the side to move to moves, each with its capture order, looking at the
+            squares alone. Castling needs the rights and en passant the square a pawn can take on, which
+            the board doesn't have. The moves may leave the king in check, except castles, which are
+            checked for passing through an attacked square. The search generates legal moves from the
+            bitboards instead; this stays as the reference --bench-perft checks against.
+        */
+        inline void generateMoves( Piece* board, bool isMaximizing, uint8_t castling, int16_t enPassant, MoveList& moves, MoveKinds kinds = MoveKinds::All )
+        {
+            auto const add = [&moves, kinds]( Piece const* board, PackedMove move )
+            {
+                if ( ( kinds == MoveKinds::Captures && !isCaptureKind( move ) ) || ( kinds == MoveKinds::Quiets && isCaptureKind( move ) ) )
+                    return;
 
-                            if ( promotedToQueen )
-                            {
-                                score += isMaximizing ? PromotedToQueen : -PromotedToQueen;
-                            }
+                moves.push_back( { move, getMoveOrder( board, move ) } );
+            };
 
-                            if ( score > 0 && isMaximizing )
-                            {
-                                score += Aggressiveness;
-                            }
+            for ( int16_t j = 0; j < 8; ++j )
+            {
+                for ( int16_t i = 0; i < 8; ++i )
+                {
+                    auto const piece = board[ board::coordsToIndex( { i, j } ) ];
 
-                            if ( dstB4.type != piece::Type::King && depth > 0 )
-                            {
-                                score += miniMax( board, depth - 1, !isMaximizing );
-                            }
+                    if ( piece.isNull() || isMaximizing != piece.isAi() )
+                        continue;
 
-                            auto const isBetterScore = isMaximizing ? score > bestMove.score : score < bestMove.score;
+                    forAllLegalMoves( board, piece, { i, j }, 0, isMaximizing, enPassant,
+                        [&add]( Piece* board, int16_t from, int16_t dst, int, bool )
+                        {
+                            if ( !board::isPromotion( board, from, dst ) )
+                                return add( board, makePackedMove( board, from, dst ) );
 
-                            if ( isBetterScore )
+                            for ( auto const promotion : Promotions )
                             {
-                                bestMove = { { board::indexToCoords( from ), board::indexToCoords( dst ) }, score };
+                                add( board, makePackedMove( board, from, dst, promotion ) );
                             }
-
-                            // undo move
-                            board[ from ] = fromB4;
-                            board[ dst ]  = dstB4;
                         }
                     );
                 }
             }
 
-            if constexpr ( std::is_same_v< RetTy, Move > )
+            auto const boards = bitboard::Boards::fromBoard( board );
+
+            for ( int i = isMaximizing * 2; i < isMaximizing * 2 + 2; ++i )
             {
-                return bestMove.move;
+                auto const& c = board::castling::Castles[ i ];
+
+                if ( !( castling & c.right ) || bitboard::isAttacked( boards, c.kingFrom, !isMaximizing ) )
+                    continue;
+
+                auto const step = c.kingDst > c.kingFrom ? 1 : -1;
+                auto isPossible = true;
+
+                for ( auto square = c.kingFrom + step; square != c.rookFrom; square += step )
+                {
+                    isPossible = isPossible && board[ square ].isNull();
+                }
+
+                for ( auto square = c.kingFrom + step; square != c.kingDst + step; square += step )
+                {
+                    isPossible = isPossible && !bitboard::isAttacked( boards, static_cast< int16_t >( square ), !isMaximizing );
+                }
+
+                if ( isPossible )
+                    add( board, makePackedMove( board, c.kingFrom, c.kingDst ) );
             }
-            else if constexpr ( std::is_same_v< RetTy, int > )
+        }
+
+        // The squares a piece of the type attacks from square. Pawns push as well, so they're handled by pawnTargets
+        template< piece::Type Type >
+        bitboard::Bitboard attacksFrom( int16_t square, bitboard::Bitboard occupied )
+        {
+            using enum piece::Type;
+
+            static_assert( Type != Pawn && Type != Null );
+
+            if constexpr ( Type == King )
+                return bitboard::KingAttacks[ square ];
+            else if constexpr ( Type == Queen )
+                return bitboard::queenAttacks( square, occupied );
+            else if constexpr ( Type == Bishop )
+                return bitboard::bishopAttacks( square, occupied );
+            else if constexpr ( Type == Knight )
+                return bitboard::KnightAttacks[ square ];
+            else
+                return bitboard::rookAttacks( square, occupied );
+        }
+
+        // Where a pawn of the side on square can go: one or two squares forward if they're empty, or a capture
+        template< bool IsAi >
+        bitboard::Bitboard pawnTargets( Position const& pos, int16_t square )
+        {
+            return bitboard::pawnTargets( pos.bitboards, square, IsAi );
+        }
+
+        /*
+            What keeps the side to move's moves legal. In check, the other pieces may only take the
+            checker or step between it and the king, and in double check only the king may move. A
+            pinned piece may only move along the line through its king. The king may not step onto an
+            attacked square, including those a checking slider would see once the king stepped aside,
+            nor castle out of, through or into check. En passant takes a second piece off the king's
+            lines, so it's tried on the bitboards instead.
+        */
+        struct Legality
+        {
+            // where pieces other than the king may go
+            bitboard::Bitboard checkMask = ~bitboard::Bitboard( 0 );
+            bitboard::Bitboard pinned = 0;
+            bitboard::Bitboard kingTargets = 0;
+            // where the king can go by castling
+            bitboard::Bitboard castles = 0;
+            // the pawns that can take en passant
+            bitboard::Bitboard enPassant = 0;
+            int16_t king = 0;
+            bool isDoubleCheck = false;
+
+            // Narrows the targets of a piece other than the king on from
+            constexpr bitboard::Bitboard restrict( int16_t from, bitboard::Bitboard targets ) const
             {
-                return bestMove.score;
+                targets &= checkMask;
+
+                if ( pinned & bitboard::squareBit( from ) )
+                    targets &= bitboard::Line[ king ][ from ];
+
+                return targets;
+            }
+        };
+
+        template< bool IsAi >
+        Legality getLegality( Position const& pos )
+        {
+            using enum piece::Type;
+
+            auto const& b = pos.bitboards;
+            auto const enemy = b.sides[ !IsAi ];
+            auto const diagonal = b.of( !IsAi, Bishop ) | b.of( !IsAi, Queen );
+            auto const straight = b.of( !IsAi, Rook ) | b.of( !IsAi, Queen );
+
+            Legality l;
+            l.king = pos.kings[ IsAi ];
+
+            auto const checkers = bitboard::attackersOf( b, l.king, b.occupied ) & enemy;
+            auto unsafe = pos.attacks.attacked( !IsAi );
+
+            for ( auto sliders = checkers & ( diagonal | straight ); sliders; )
+            {
+                auto const square = bitboard::popFirst( sliders );
+                unsafe |= bitboard::attacksOf( pos.board[ square ], square, b.occupied & ~bitboard::squareBit( l.king ) );
+            }
+
+            l.kingTargets = bitboard::KingAttacks[ l.king ] & ~b.sides[ IsAi ] & ~unsafe;
+
+            if ( checkers )
+            {
+                l.isDoubleCheck = bitboard::count( checkers ) > 1;
+                l.checkMask = checkers | bitboard::Between[ l.king ][ bitboard::first( checkers ) ];
             }
             else
             {
-                static_assert( std::is_same_v< RetTy, int >, "Return type must be int or ai::Move!" );
+                for ( auto const& c : { board::castling::Castles[ IsAi * 2 ], board::castling::Castles[ IsAi * 2 + 1 ] } )
+                {
+                    auto const crossed = bitboard::Between[ c.kingFrom ][ c.kingDst ] | bitboard::squareBit( c.kingDst );
+
+                    if ( ( pos.castling & c.right ) && !( bitboard::Between[ c.kingFrom ][ c.rookFrom ] & b.occupied ) && !( crossed & unsafe ) )
+                        l.castles |= bitboard::squareBit( c.kingDst );
+                }
+            }
+
+            if ( pos.enPassant != Position::NoEnPassant )
+            {
+                for ( auto pawns = bitboard::PawnAttacks[ !IsAi ][ pos.enPassant ] & b.of( IsAi, Pawn ); pawns; )
+                {
+                    auto const from = bitboard::popFirst( pawns );
+                    auto const victim = board::enPassantVictim( from, pos.enPassant );
+                    auto const occupied = ( b.occupied ^ bitboard::squareBit( from ) ^ bitboard::squareBit( victim ) ) | bitboard::squareBit( pos.enPassant );
+
+                    if ( !( bitboard::attackersOf( b, l.king, occupied ) & enemy & ~bitboard::squareBit( victim ) ) )
+                        l.enPassant |= bitboard::squareBit( from );
+                }
+            }
+
+            // the enemy sliders that would see the king through exactly one of the side's pieces
+            auto const snipers = ( bitboard::rookAttacks( l.king, enemy ) & straight )
+                               | ( bitboard::bishopAttacks( l.king, enemy ) & diagonal );
+
+            for ( auto s = snipers; s; )
+            {
+                auto const between = bitboard::Between[ l.king ][ bitboard::popFirst( s ) ] & b.occupied;
+
+                if ( bitboard::count( between ) == 1 && ( between & b.sides[ IsAi ] ) )
+                    l.pinned |= between;
             }
+
+            return l;
         }
-    }
 
-    bool printNumberWithCommas( uint64_t n )
-    {
-        if ( n == 0 )
-            return false;
+        /*
+            Appends a move with its capture order, the same as getMoveOrder gives it. The moving piece and
+            what it promotes to are known at compile time, so only the victim is read from the board.
+        */
+        template< piece::Type Type, piece::Type Promotion = piece::Type::Null >
+        void addMove( Piece const* board, MoveList& moves, int16_t from, int16_t dst )
+        {
+            constexpr auto AttackerScore = std::min( getPieceScore( Type ), 63 );
 
-        auto const comma = printNumberWithCommas( n / 1000 );
+            auto const victim = board[ dst ].type;
+            auto const isCapture = victim != piece::Type::Null;
 
-        if ( comma )
+            PackedMove const move( from, dst, isCapture, Promotion );
+
+            auto const order = ( Promotion == piece::Type::Queen ? PromotionOrder : 0 )
+                             + ( isCapture ? CaptureOrder + getPieceScore( victim ) * 64 + 64 - AttackerScore : 0 );
+
+            assert( move == makePackedMove( board, from, dst, Promotion ) && order == getMoveOrder( board, move ) );
+
+            moves.push_back( { move, order } );
+        }
+
+        template< bool IsAi, MoveKinds Kinds >
+        void generatePawnMoves( Position const& pos, Legality const& l, MoveList& moves )
+        {
+            using enum piece::Type;
+
+            constexpr auto LastRow = bitboard::PromotionRows[ IsAi ];
+
+            auto const enemy = pos.bitboards.sides[ !IsAi ];
+
+            for ( auto pawns = pos.bitboards.of( IsAi, Pawn ); pawns; )
+            {
+                auto const from = bitboard::popFirst( pawns );
+                auto const targets = l.restrict( from, pawnTargets< IsAi >( pos, from ) );
+
+                // promoting to a queen counts as a capture, as it wins material, and to anything else as a quiet move
+                for ( auto promotions = targets & LastRow; promotions; )
+                {
+                    auto const dst = bitboard::popFirst( promotions );
+
+                    if constexpr ( Kinds != MoveKinds::Quiets )
+                        addMove< Pawn, Queen >( pos.board.data(), moves, from, dst );
+
+                    if constexpr ( Kinds != MoveKinds::Captures )
+                    {
+                        addMove< Pawn, Knight >( pos.board.data(), moves, from, dst );
+                        addMove< Pawn, Rook >( pos.board.data(), moves, from, dst );
+                        addMove< Pawn, Bishop >( pos.board.data(), moves, from, dst );
+                    }
+                }
+
+                auto others = targets & ~LastRow;
+
+                if constexpr ( Kinds == MoveKinds::Captures )
+                    others &= enemy;
+                else if constexpr ( Kinds == MoveKinds::Quiets )
+                    others &= ~enemy;
+
+                while ( others )
+                {
+                    addMove< Pawn >( pos.board.data(), moves, from, bitboard::popFirst( others ) );
+                }
+            }
+
+            if constexpr ( Kinds != MoveKinds::Quiets )
+            {
+                for ( auto pawns = l.enPassant; pawns; )
+                {
+                    PackedMove const move( bitboard::popFirst( pawns ), pos.enPassant, true );
+                    moves.push_back( { move, getMoveOrder( pos.board.data(), move ) } );
+                }
+            }
+        }
+
+        template< bool IsAi, MoveKinds Kinds, piece::Type Type >
+        void generatePieceMoves( Position const& pos, Legality const& l, MoveList& moves )
+        {
+            auto const& b = pos.bitboards;
+
+            auto const allowed = Kinds == MoveKinds::Captures ? b.sides[ !IsAi ]
+                               : Kinds == MoveKinds::Quiets   ? ~b.occupied
+                               : ~b.sides[ IsAi ];
+
+            // castling never captures, so it's left out of the captures by allowed
+            if constexpr ( Type == piece::Type::King )
+            {
+                for ( auto targets = ( l.kingTargets | l.castles ) & allowed; targets; )
+                {
+                    addMove< Type >( pos.board.data(), moves, l.king, bitboard::popFirst( targets ) );
+                }
+
+                return;
+            }
+
+            for ( auto pieces = b.of( IsAi, Type ); pieces; )
+            {
+                auto const from = bitboard::popFirst( pieces );
+
+                for ( auto targets = l.restrict( from, attacksFrom< Type >( from, b.occupied ) & allowed ); targets; )
+                {
+                    addMove< Type >( pos.board.data(), moves, from, bitboard::popFirst( targets ) );
+                }
+            }
+        }
+
+        /*
+            Appends the legal moves of the side to move to moves, each with its capture order. Instantiated
+            per side and kind of move, and unrolled per piece type, so the loops have no side or type to test.
+        */
+        template< bool IsAi, MoveKinds Kinds >
+        void generateMoves( Position const& pos, Legality const& l, MoveList& moves )
         {
-            printf(",%03lld", n % 1000 );
+            using enum piece::Type;
+
+            if ( !l.isDoubleCheck )
+            {
+                generatePawnMoves< IsAi, Kinds >( pos, l, moves );
+                generatePieceMoves< IsAi, Kinds, Knight >( pos, l, moves );
+                generatePieceMoves< IsAi, Kinds, Bishop >( pos, l, moves );
+                generatePieceMoves< IsAi, Kinds, Rook >( pos, l, moves );
+                generatePieceMoves< IsAi, Kinds, Queen >( pos, l, moves );
+            }
+
+            generatePieceMoves< IsAi, Kinds, King >( pos, l, moves );
         }
-        else
+
+        template< bool IsAi, MoveKinds Kinds >
+        void generateMoves( Position const& pos, MoveList& moves )
         {
-            printf("%lld", n % 1000 );
+            generateMoves< IsAi, Kinds >( pos, getLegality< IsAi >( pos ), moves );
         }
 
-        return true;
-    };
+        template< bool IsAi >
+        void generateMoves( Position const& pos, MoveList& moves, MoveKinds kinds )
+        {
+            switch ( kinds )
+            {
+            case MoveKinds::All:
+                return generateMoves< IsAi, MoveKinds::All >( pos, moves );
+            case MoveKinds::Captures:
+                return generateMoves< IsAi, MoveKinds::Captures >( pos, moves );
+            case MoveKinds::Quiets:
+                return generateMoves< IsAi, MoveKinds::Quiets >( pos, moves );
+            }
+        }
 
-    void makeMove( Piece const* b, std::mutex& m, Result& res, Difficulty difficulty )
-    {
-        nodesGenerated = 0;
-        auto const timeBefore = GetTime();
+        // For callers that don't know the side to move at compile time
+        inline void generateMoves( Position const& pos, MoveList& moves, MoveKinds kinds = MoveKinds::All )
+        {
+            if ( pos.aiToMove )
+                generateMoves< true >( pos, moves, kinds );
+            else
+                generateMoves< false >( pos, moves, kinds );
+        }
 
-        std::array< Piece, 64 > b_arr;
+        // Where the piece of the side on square can legally move to
+        template< bool IsAi >
+        bitboard::Bitboard getMoveTargets( Position const& pos, Legality const& l, int16_t square )
+        {
+            using enum piece::Type;
 
-        std::copy( b, b + 64, b_arr.begin() );
+            auto const occupied = pos.bitboards.occupied;
+            auto const own = pos.bitboards.sides[ IsAi ];
+            auto const type = pos.board[ square ].type;
 
-        auto const bestMove = details::miniMax< Move >( b_arr.data(), static_cast< int >( difficulty ), true );
+            if ( type == King )
+                return l.kingTargets | l.castles;
 
-        auto const timeAfter = GetTime();
+            if ( l.isDoubleCheck )
+                return 0;
 
-        auto lock = std::scoped_lock< std::mutex >( m );
+            switch ( type )
+            {
+            case Queen:  return l.restrict( square, attacksFrom< Queen >( square, occupied ) & ~own );
+            case Bishop: return l.restrict( square, attacksFrom< Bishop >( square, occupied ) & ~own );
+            case Knight: return l.restrict( square, attacksFrom< Knight >( square, occupied ) & ~own );
+            case Rook:   return l.restrict( square, attacksFrom< Rook >( square, occupied ) & ~own );
+            case Pawn:
+                return l.restrict( square, pawnTargets< IsAi >( pos, square ) )
+                     | ( l.enPassant & bitboard::squareBit( square ) ? bitboard::squareBit( pos.enPassant ) : 0 );
+            case King:
+            case Null:   break;
+            }
 
-        res = Result{ bestMove, true };
+            return 0;
+        }
 
-        std::cout << "Took " << timeAfter - timeBefore << "s to generate ";
-        printNumberWithCommas( nodesGenerated );
-        std::cout << " nodes\n";
+        inline Move toMove( PackedMove m )
+        {
+            return { board::indexToCoords( m.from() ), board::indexToCoords( m.dst() ), m.promotion() };
+        }
+
+        // Material-only minimax over every move to depth, which --compare-minimax measures the real search against
+        template< bool IsMaximizing, class RetTy = int >
+        RetTy miniMax( Position& pos, int depth, uint64_t& nodesGenerated )
+        {
+            MoveAndScore bestMove( IsMaximizing );
+
+            MoveList moves;
+            generateMoves< IsMaximizing, MoveKinds::All >( pos, moves );
+
+            // checkmate costs the king, stalemate nothing
+            if constexpr ( std::is_same_v< RetTy, int > )
+            {
+                if ( moves.empty() )
+                    return pos.isInCheck( IsMaximizing ) ? getPieceScore( piece::Type::King ) * ( IsMaximizing ? -1 : 1 ) : 0;
+            }
+
+            for ( auto const& [m, _] : moves )
+            {
+                nodesGenerated += 1;
+
+                // make move
+                auto const undo = board::movePiece( pos, m.from(), m.dst(), m.promotion() );
+
+                auto score = getPieceScore( undo.captured.type ) * ( IsMaximizing ? 1 : -1 );
+
+                if ( m.promotion() == piece::Type::Queen )
+                {
+                    score += IsMaximizing ? PromotedToQueen : -PromotedToQueen;
+                }
+
+                if ( score > 0 && IsMaximizing )
+                {
+                    score += Aggressiveness;
+                }
+
+                if ( depth > 0 )
+                {
+                    score += miniMax< !IsMaximizing >( pos, depth - 1, nodesGenerated );
+                }
+
+                auto const isBetterScore = IsMaximizing ? score > bestMove.score : score < bestMove.score;
+
+                if ( isBetterScore )
+                {
+                    bestMove = { toMove( m ), score };
+                }
+
+                // undo move
+                board::undoMove( pos, m.from(), m.dst(), undo );
+            }
+
+            if constexpr ( std::is_same_v< RetTy, Move > )
+            {
+                return bestMove.move;
+            }
+            else if constexpr ( std::is_same_v< RetTy, int > )
+            {
+                return bestMove.score;
+            }
+            else
+            {
+                static_assert( std::is_same_v< RetTy, int >, "Return type must be int or ai::Move!" );
+            }
+        }
+
+        // Insertion sort: it's stable, so equally ordered moves keep their generation order, and needs no buffer
+        template< class It >
+        void sortMoves( It begin, It end )
+        {
+            for ( auto it = begin; it != end; ++it )
+            {
+                auto const m = *it;
+                auto hole = it;
+
+                for ( ; hole != begin && ( hole - 1 )->order < m.order; --hole )
+                {
+                    *hole = *( hole - 1 );
+                }
+
+                *hole = m;
+            }
+        }
+
+        template< bool IsAi, MoveKinds Kinds >
+        MoveList generateOrderedMoves( Position const& pos )
+        {
+            MoveList moves;
+
+            generateMoves< IsAi, Kinds >( pos, moves );
+
+            sortMoves( moves.begin(), moves.end() );
+
+            return moves;
+        }
+
+        constexpr bool isQuiet( PackedMove m )
+        {
+            return !m.isCapture() && !m.isPromotion();
+        }
+
+        inline PackedMove getPreviousMove( SearchContext const& ctx, int ply )
+        {
+            return ply > 0 ? ctx.moveStack[ ply - 1 ] : PackedMove{};
+        }
+
+        template< class It >
+        void orderQuietMoves( It begin, It end, SearchContext const& ctx, int ply, bool isAi )
+        {
+            auto const previous = getPreviousMove( ctx, ply );
+
+            for ( auto m = begin; m != end; ++m )
+            {
+                if ( isQuiet( m->move ) )
+                    m->order = ctx.heuristics.quietOrder( ply, isAi, m->move, previous );
+            }
+        }
+
+        inline ordering::Source getCutoffSource( SearchContext const& ctx, int ply, PackedMove m, tt::Entry const* hashEntry )
+        {
+            using enum ordering::Source;
+
+            if ( hashEntry && hashEntry->move == m )
+                return Hash;
+
+            if ( !isQuiet( m ) )
+                return Capture;
+
+            if ( ctx.heuristics.isKiller( ply, m ) )
+                return Killer;
+
+            if ( ctx.heuristics.isCounterMove( getPreviousMove( ctx, ply ), m ) )
+                return CounterMove;
+
+            return History;
+        }
+
+        // Moves the hash move, if it was generated, to the front
+        inline void orderHashMoveFirst( MoveList& moves, PackedMove hashMove )
+        {
+            auto const first = std::find_if( moves.begin(), moves.end(), [hashMove]( OrderedMove const& m )
+            {
+                return m.move == hashMove;
+            } );
+
+            if ( first != moves.end() )
+                std::rotate( moves.begin(), first, first + 1 );
+        }
+
+        /*
+            Hands out the moves of a node best first, generating each group only once everything before
+            it has been tried: the hash move, captures that don't lose material, the killers and counter
+            move, the other quiet moves by history, and last the captures that do lose material.
+            With staged generation off, every move is generated and sorted up front instead.
+        */
+        template< bool IsAi >
+        class MovePicker
+        {
+        public:
+            MovePicker( SearchContext& ctx, Position& pos, int ply, tt::Entry const* hashEntry ):
+                m_ctx( ctx ),
+                m_pos( pos ),
+                m_legality( getLegality< IsAi >( pos ) ),
+                m_ply( ply ),
+                m_stage( useStagedMoveGeneration ? Stage::HashMove : Stage::GenerateAll )
+            {
+                if ( hashEntry )
+                    m_hashMove = hashEntry->move;
+
+                m_ctx.stats.onGenerate( 0, true );
+            }
+
+            // Returns false once every move has been handed out
+            bool next( PackedMove& m )
+            {
+                while ( true )
+                {
+                    switch ( m_stage )
+                    {
+                    case Stage::GenerateAll:
+                        generate< MoveKinds::All >();
+
+                        if ( useOrderingHeuristics )
+                            orderQuietMoves( m_moves.begin(), m_moves.end(), m_ctx, m_ply, IsAi );
+
+                        sortMoves( m_moves.begin(), m_moves.end() );
+
+                        if ( !m_hashMove.isNull() )
+                            orderHashMoveFirst( m_moves, m_hashMove );
+
+                        m_stage = Stage::All;
+                        break;
+
+                    case Stage::All:
+                        if ( m_current < m_moves.size() )
+                        {
+                            m = m_moves[ m_current++ ].move;
+                            return true;
+                        }
+
+                        m_stage = Stage::Done;
+                        break;
+
+                    case Stage::HashMove:
+                        m_stage = Stage::GenerateCaptures;
+
+                        if ( !m_hashMove.isNull() && isPlayable( m_hashMove ) )
+                        {
+                            m = m_hashMove;
+                            return true;
+                        }
+
+                        break;
+
+                    case Stage::GenerateCaptures:
+                        generate< MoveKinds::Captures >();
+                        m_stage = Stage::GoodCaptures;
+                        break;
+
+                    case Stage::GoodCaptures:
+                        while ( pickBest( m ) )
+                        {
+                            if ( m == m_hashMove )
+                                continue;
+
+                            // losing captures go back to the front of the list, which has already been handed out
+                            if ( !m.isPromotion() && exchange::evaluate( m_pos.bitboards, m_pos.board.data(), m.from(), m.dst(), takePieceScores ) < 0 )
+                            {
+                                m_moves[ m_badCaptures++ ] = m_moves[ m_current - 1 ];
+                                continue;
+                            }
+
+                            return true;
+                        }
+
+                        m_stage = Stage::Killers;
+
+                        if ( useOrderingHeuristics )
+                        {
+                            m_killers = {
+                                m_ctx.heuristics.killer( m_ply, 0 ),
+                                m_ctx.heuristics.killer( m_ply, 1 ),
+                                m_ctx.heuristics.counterMove( getPreviousMove( m_ctx, m_ply ) )
+                            };
+                        }
+
+                        break;
+
+                    case Stage::Killers:
+                        while ( m_currentKiller < m_killers.size() )
+                        {
+                            auto& killer = m_killers[ m_currentKiller++ ];
+
+                            if ( !isKillerPlayable( killer ) )
+                            {
+                                // so the quiet stage doesn't skip it
+                                killer = {};
+                                continue;
+                            }
+
+                            m = killer;
+                            return true;
+                        }
+
+                        m_stage = Stage::GenerateQuiets;
+                        break;
+
+                    case Stage::GenerateQuiets:
+                        // the quiet moves replace the good captures, after the bad ones
+                        m_moves.resize( m_badCaptures );
+                        m_current = m_badCaptures;
+
+                        generate< MoveKinds::Quiets >();
+
+                        if ( useOrderingHeuristics )
+                            orderQuietMoves( m_moves.begin() + m_current, m_moves.end(), m_ctx, m_ply, IsAi );
+
+                        m_stage = Stage::Quiets;
+                        break;
+
+                    case Stage::Quiets:
+                        while ( pickBest( m ) )
+                        {
+                            if ( m == m_hashMove || isKiller( m ) )
+                                continue;
+
+                            return true;
+                        }
+
+                        m_current = 0;
+                        m_stage = Stage::BadCaptures;
+                        break;
+
+                    case Stage::BadCaptures:
+                        if ( m_current < m_badCaptures )
+                        {
+                            m = m_moves[ m_current++ ].move;
+                            return true;
+                        }
+
+                        m_stage = Stage::Done;
+                        break;
+
+                    case Stage::Done:
+                        return false;
+                    }
+                }
+            }
+
+        private:
+            enum class Stage
+            {
+                GenerateAll,
+                All,
+                HashMove,
+                GenerateCaptures,
+                GoodCaptures,
+                Killers,
+                GenerateQuiets,
+                Quiets,
+                BadCaptures,
+                Done
+            };
+
+            template< MoveKinds Kinds >
+            void generate()
+            {
+                auto const sizeB4 = m_moves.size();
+
+                generateMoves< IsAi, Kinds >( m_pos, m_legality, m_moves );
+
+                m_ctx.stats.onGenerate( m_moves.size() - sizeB4, false );
+            }
+
+            // Selection sort one move at a time, as most nodes never get past the first few
+            bool pickBest( PackedMove& m )
+            {
+                if ( m_current >= m_moves.size() )
+                    return false;
+
+                auto const best = std::max_element( m_moves.begin() + m_current, m_moves.end(), []( OrderedMove const& a, OrderedMove const& b )
+                {
+                    return a.order < b.order;
+                } );
+
+                std::iter_swap( m_moves.begin() + m_current, best );
+
+                m = m_moves[ m_current++ ].move;
+
+                return true;
+            }
+
+            // Moves from the hash table or another node may not be possible here. Only the moving piece's targets are generated to check
+            bool isPlayable( PackedMove move )
+            {
+                auto const piece = m_pos.board[ move.from() ];
+
+                if ( piece.isNull() || piece.isAi() != IsAi )
+                    return false;
+
+                auto const targets = getMoveTargets< IsAi >( m_pos, m_legality, move.from() );
+
+                m_ctx.stats.onGenerate( bitboard::count( targets ), false );
+
+                // a move that doesn't promote where a pawn now would is packed with a queen, so it doesn't match
+                auto const promotion = move.isPromotion() ? move.promotion() : piece::Type::Queen;
+
+                return ( targets & bitboard::squareBit( move.dst() ) ) && makePackedMove( m_pos.board.data(), move.from(), move.dst(), promotion ) == move;
+            }
+
+            bool isKillerPlayable( PackedMove killer )
+            {
+                if ( killer.isNull() || killer == m_hashMove )
+                    return false;
+
+                // the counter move can be one of the killers
+                for ( size_t i = 0; i + 1 < m_currentKiller; ++i )
+                {
+                    if ( m_killers[ i ] == killer )
+                        return false;
+                }
+
+                return isPlayable( killer );
+            }
+
+            bool isKiller( PackedMove m ) const
+            {
+                return std::find( m_killers.begin(), m_killers.end(), m ) != m_killers.end();
+            }
+
+        private:
+            SearchContext& m_ctx;
+            Position const& m_pos;
+            // worked out once for every stage and every move from the hash table or another node
+            Legality m_legality;
+            int m_ply;
+            Stage m_stage;
+            PackedMove m_hashMove{};
+            MoveList m_moves;
+            size_t m_current = 0;
+            // the losing captures are moved to the front of m_moves
+            size_t m_badCaptures = 0;
+            std::array< PackedMove, 3 > m_killers{};
+            size_t m_currentKiller = 0;
+        };
+
+        // Captures that can't win back more than this above alpha are skipped in quiescence
+        constexpr int DeltaMargin = 10;
+
+        /*
+            Material and piece-square bonuses for the side to move, kept up to date by board::movePiece,
+            or the network's opinion when one is loaded. With a king gone the network has nothing to
+            say and the material decides.
+        */
+        inline int getStaticScore( Position const& pos )
+        {
+            assert( pos.eval == evaluation::Accumulator::fromBoard( pos.board.data() ) );
+            assert( pos.bitboards == bitboard::Boards::fromBoard( pos.board.data() ) );
+            assert( pos.kings == Position::fromBoard( pos.board.data(), pos.aiToMove ).kings );
+            assert( pos.attacks == attackmap::Map::fromBoards( pos.bitboards ) );
+            assert( pos.key == pos.computeKey() );
+
+            if ( nnue::network && pos.nnue.hasBothKings() )
+            {
+                assert( pos.nnue == nnue::Accumulator::fromBoard( *nnue::network, pos.board.data() ) );
+
+                return nnue::evaluate( *nnue::network, pos.nnue, pos.aiToMove );
+            }
+
+            return evaluation::evaluate( pos.eval, pos.aiToMove );
+        }
+
+        // Without pieces, passing is often the best move, so null moves would prune good lines
+        constexpr bool hasNonPawnMaterial( Position const& pos, bool isAi )
+        {
+            return pos.eval.phase[ isAi ] > 0;
+        }
+
+        // Passes the turn without moving a piece, which loses the chance to take en passant. Returns the square, for undoNullMove
+        inline int16_t makeNullMove( Position& pos )
+        {
+            auto const enPassant = pos.enPassant;
+
+            pos.aiToMove = !pos.aiToMove;
+            pos.enPassant = Position::NoEnPassant;
+            pos.key ^= zobrist::AiToMove ^ zobrist::enPassantKey( enPassant );
+
+            return enPassant;
+        }
+
+        inline void undoNullMove( Position& pos, int16_t enPassant )
+        {
+            pos.aiToMove = !pos.aiToMove;
+            pos.enPassant = enPassant;
+            pos.key ^= zobrist::AiToMove ^ zobrist::enPassantKey( enPassant );
+        }
+
+        /*
+            Searches captures and promotions only, until the position is quiet. The side to move can
+            always stand pat on the static score instead. Captures that lose material by static
+            exchange are not searched. In check there is no standing pat and every evasion is searched,
+            so a mate at the end of a capture sequence is seen.
+        */
+        template< bool IsAi >
+        int quiescence( SearchContext& ctx, Position& pos, int ply, int alpha, int beta )
+        {
+            assert( pos.aiToMove == IsAi );
+
+            auto const inCheck = pos.isInCheck( IsAi );
+
+            // stand pat, or mated if no evasion is found
+            int bestScore = inCheck ? -MateScore + ply : getStaticScore( pos );
+
+            if ( !inCheck )
+            {
+                if ( bestScore >= beta )
+                    return bestScore;
+
+                // even winning a queen can't bring the score up to alpha
+                if ( bestScore + getPieceScore( piece::Type::Queen ) + PromotedToQueen + DeltaMargin < alpha )
+                    return bestScore;
+
+                alpha = std::max( alpha, bestScore );
+            }
+
+            auto const moves = inCheck ? generateOrderedMoves< IsAi, MoveKinds::All >( pos )
+                                       : generateOrderedMoves< IsAi, MoveKinds::Captures >( pos );
+            auto const attacks = pos.attacks;
+
+            for ( auto const& [m, _] : moves )
+            {
+                // en passant, onto an empty square, is never pruned
+                if ( !inCheck && !m.isPromotion() && !pos.board[ m.dst() ].isNull() )
+                {
+                    // delta pruning
+                    if ( bestScore + getPieceScore( pos.board[ m.dst() ].type ) + DeltaMargin < alpha )
+                        continue;
+
+                    if ( exchange::evaluate( pos.bitboards, pos.board.data(), m.from(), m.dst(), takePieceScores ) < 0 )
+                        continue;
+                }
+
+                if ( ctx.shouldStop() )
+                    return 0;
+
+                ctx.stats.onQuiescenceNode( ctx.iteration );
+
+                // make move
+                auto const undo = board::movePiece( pos, m.from(), m.dst(), m.promotion() );
+
+                auto const score = -quiescence< !IsAi >( ctx, pos, ply + 1, -beta, -alpha );
+
+                // undo move
+                board::undoMove( pos, m.from(), m.dst(), undo, attacks );
+
+                if ( ctx.stopped )
+                    return 0;
+
+                bestScore = std::max( bestScore, score );
+                alpha = std::max( alpha, score );
+
+                if ( alpha >= beta )
+                    break;
+            }
+
+            return bestScore;
+        }
+
+        // Null move pruning is tried from this depth, reducing the reply's depth by 2 plus a quarter of the depth
+        constexpr int NullMoveMinDepth = 2;
+
+        // Quiet moves after the first few are searched a ply shallower, then re-searched if they beat alpha
+        constexpr int LateMoveMinDepth = 2;
+        constexpr size_t LateMoveIndex = 3;
+
+        // How far below alpha the static score must be to prune quiet moves / drop into quiescence, by depth
+        constexpr std::array FutilityMargins = { 6, 15 };
+        constexpr std::array RazorMargins = { 12, 25 };
+
+        /*
+            Negamax form of miniMax with alpha-beta pruning. Scores are from the point of view of the
+            side to move. Instead of stopping dead, the last ply is followed by a quiescence search.
+            Only the root passes bestMove.
+        */
+        template< bool IsAi >
+        int alphaBeta( SearchContext& ctx, Position& pos, int depth, int ply, int alpha, int beta, Move* bestMove = nullptr )
+        {
+            assert( pos.aiToMove == IsAi );
+            auto const alphaB4 = alpha;
+
+            ctx.pvLength[ ply ] = ply;
+
+            // small endgames are looked up instead of searched, except at the root, which needs a move. The tables have no castling or en passant
+            if ( !bestMove && pos.pieceCount() <= tablebase::tablebases.maxPieces() && pos.castling == 0 && pos.enPassant == Position::NoEnPassant )
+            {
+                if ( auto const value = tablebase::tablebases.probe( pos.board.data(), pos.bitboards.occupied, pos.aiToMove ) )
+                {
+                    ctx.stats.onTablebaseHit();
+                    return tablebase::toScore( *value );
+                }
+            }
+
+            tt::Entry hashEntry;
+            auto const hashHit = transpositionTable.probe( pos.key, hashEntry );
+            ctx.stats.onProbe( hashHit );
+
+            if ( hashHit && !bestMove && hashEntry.depth >= depth )
+            {
+                auto const hashScore = fromHashScore( hashEntry.score, ply );
+
+                if ( hashEntry.bound == tt::Bound::Exact )
+                    return hashScore;
+
+                if ( hashEntry.bound == tt::Bound::Lower && hashScore >= beta )
+                    return hashScore;
+
+                if ( hashEntry.bound == tt::Bound::Upper && hashScore <= alpha )
+                    return hashScore;
+            }
+
+            auto const isRoot = bestMove != nullptr;
+            auto const inCheck = pos.isInCheck( IsAi );
+            auto const staticScore = getStaticScore( pos );
+
+            // razoring: far enough below alpha near the leaves that only captures could help
+            if ( pruning.razoring && !isRoot && !inCheck && depth < static_cast< int >( RazorMargins.size() )
+              && staticScore + RazorMargins[ depth ] < alpha )
+            {
+                auto const score = quiescence< IsAi >( ctx, pos, ply, alpha, beta );
+
+                if ( ctx.stopped )
+                    return 0;
+
+                if ( score < alpha )
+                    return score;
+            }
+
+            // null move: if passing still fails high, a real move will too
+            auto const previousWasNullMove = ply > 0 && ctx.moveStack[ ply - 1 ].isNull();
+
+            if ( pruning.nullMove && !isRoot && !inCheck && !previousWasNullMove && depth >= NullMoveMinDepth
+              && staticScore >= beta && hasNonPawnMaterial( pos, IsAi ) )
+            {
+                auto const reduction = 2 + depth / 4;
+
+                auto const enPassant = makeNullMove( pos );
+                ctx.moveStack[ ply ] = {};
+
+                auto const score = depth - 1 - reduction >= 0
+                    ? -alphaBeta< !IsAi >( ctx, pos, depth - 1 - reduction, ply + 1, -beta, -beta + 1 )
+                    : -quiescence< !IsAi >( ctx, pos, ply + 1, -beta, -beta + 1 );
+
+                undoNullMove( pos, enPassant );
+
+                if ( ctx.stopped )
+                    return 0;
+
+                if ( score >= beta )
+                    return score;
+            }
+
+            auto const canPruneQuietMoves = pruning.futility && !isRoot && !inCheck && depth < static_cast< int >( FutilityMargins.size() )
+                                         && staticScore + FutilityMargins[ depth ] <= alpha;
+
+            MovePicker< IsAi > picker( ctx, pos, ply, hashHit ? &hashEntry : nullptr );
+
+            int bestScore = -Infinity;
+            PackedMove best{};
+
+            // quiet moves that failed to cut off, to lower their history if a later one does
+            std::array< PackedMove, 64 > quietsTried;
+            size_t quietsTriedCount = 0;
+
+            PackedMove m;
+
+            // every move is undone back to this, so it's put back rather than worked out again
+            auto const attacks = pos.attacks;
+
+            for ( size_t moveIndex = 0; picker.next( m ); ++moveIndex )
+            {
+                // futility: near the leaves a quiet move can't make up the difference to alpha
+                if ( canPruneQuietMoves && moveIndex > 0 && isQuiet( m ) )
+                {
+                    bestScore = std::max( bestScore, staticScore + FutilityMargins[ depth ] );
+                    continue;
+                }
+
+                if ( ctx.shouldStop() )
+                    return 0;
+
+                ctx.stats.onNode( ctx.iteration );
+
+                auto const reduceLateMove = pruning.lateMoveReductions && !isRoot && !inCheck
+                                         && depth >= LateMoveMinDepth && moveIndex >= LateMoveIndex && isQuiet( m )
+                                         && !ctx.heuristics.isKiller( ply, m );
+
+                // make move
+                auto const undo = board::movePiece( pos, m.from(), m.dst(), m.promotion() );
+
+                transpositionTable.prefetch( pos.key );
+
+                ctx.moveStack[ ply ] = m;
+
+                ctx.pvLength[ ply + 1 ] = ply + 1;
+
+                // searches the reply within ( a, b ) of this node's scores, in quiescence once out of depth
+                auto const searchReply = [&]( int replyDepth, int a, int b )
+                {
+                    return -( replyDepth >= 0
+                        ? alphaBeta< !IsAi >( ctx, pos, replyDepth, ply + 1, -b, -a )
+                        : quiescence< !IsAi >( ctx, pos, ply + 1, -b, -a ) );
+                };
+
+                int score;
+
+                if ( moveIndex == 0 )
+                {
+                    score = searchReply( depth - 1, alpha, beta );
+                }
+                else
+                {
+                    auto const reduction = reduceLateMove ? 1 + ( depth >= 6 && moveIndex >= 8 ) : 0;
+
+                    // principal variation search: a null window is enough to show a later move is no better
+                    score = searchReply( depth - 1 - reduction, alpha, alpha + 1 );
+
+                    if ( score > alpha && reduction > 0 )
+                        score = searchReply( depth - 1, alpha, alpha + 1 );
+
+                    if ( score > alpha && score < beta )
+                        score = searchReply( depth - 1, alpha, beta );
+                }
+
+                // undo move
+                board::undoMove( pos, m.from(), m.dst(), undo, attacks );
+
+                if ( ctx.stopped )
+                    return 0;
+
+                if ( score > bestScore )
+                {
+                    bestScore = score;
+                    best = m;
+
+                    if ( bestMove )
+                    {
+                        *bestMove = toMove( m );
+                    }
+                }
+
+                if ( score > alpha )
+                {
+                    auto& pv = ctx.pvTable[ ply ];
+                    auto const& childPv = ctx.pvTable[ ply + 1 ];
+
+                    pv[ ply ] = m;
+                    std::copy( childPv.begin() + ply + 1, childPv.begin() + ctx.pvLength[ ply + 1 ], pv.begin() + ply + 1 );
+                    ctx.pvLength[ ply ] = std::max( ctx.pvLength[ ply + 1 ], ply + 1 );
+                }
+
+                alpha = std::max( alpha, score );
+
+                if ( alpha >= beta )
+                {
+                    ctx.stats.onCutoff( getCutoffSource( ctx, ply, m, hashHit ? &hashEntry : nullptr ), moveIndex == 0 );
+
+                    if ( useOrderingHeuristics && isQuiet( m ) )
+                    {
+                        ctx.heuristics.onQuietCutoff( ply, IsAi, depth, m, getPreviousMove( ctx, ply ),
+                                                      std::span( quietsTried.data(), quietsTriedCount ) );
+                    }
+
+                    break;
+                }
+
+                if ( isQuiet( m ) && quietsTriedCount < quietsTried.size() )
+                    quietsTried[ quietsTriedCount++ ] = m;
+            }
+
+            // no legal move: checkmate or stalemate
+            if ( bestScore == -Infinity )
+                bestScore = inCheck ? -MateScore + ply : 0;
+
+            tt::Entry entry;
+            entry.move = best;
+            entry.score = toHashScore( bestScore, ply );
+            entry.depth = depth;
+            entry.bound = bestScore >= beta ? tt::Bound::Lower
+                        : bestScore > alphaB4 ? tt::Bound::Exact
+                        : tt::Bound::Upper;
+
+            transpositionTable.store( pos.key, entry );
+            ctx.stats.onStore();
+
+            return bestScore;
+        }
+
+        // Only valid if !ctx.stopped afterwards. The previous iteration's best move is searched first through the hash table
+        inline MoveAndScore searchRoot( SearchContext& ctx, Position& pos, int depth, int alpha = -Infinity, int beta = Infinity )
+        {
+            MoveAndScore best( true );
+
+            best.score = pos.aiToMove
+                ? alphaBeta< true >( ctx, pos, depth, 0, alpha, beta, &best.move )
+                : alphaBeta< false >( ctx, pos, depth, 0, alpha, beta, &best.move );
+
+            return best;
+        }
+
+        // Iterations from this depth start with a window around the previous score, widened on failure
+        constexpr int AspirationMinDepth = 3;
+        constexpr int AspirationWindow = 6;
+        constexpr int MaxAspirationWindow = 200;
+
+        inline MoveAndScore aspirationSearch( SearchContext& ctx, Position& pos, int depth, int previousScore )
+        {
+            if ( depth < AspirationMinDepth )
+                return searchRoot( ctx, pos, depth );
+
+            auto delta = AspirationWindow;
+            auto alpha = previousScore - delta;
+            auto beta = previousScore + delta;
+
+            while ( true )
+            {
+                auto const best = searchRoot( ctx, pos, depth, alpha, beta );
+
+                if ( ctx.stopped )
+                    return best;
+
+                if ( alpha < best.score && best.score < beta )
+                    return best;
+
+                delta *= 2;
+
+                if ( best.score <= alpha )
+                    alpha = delta > MaxAspirationWindow ? -Infinity : best.score - delta;
+                else
+                    beta = delta > MaxAspirationWindow ? Infinity : best.score + delta;
+            }
+        }
+
+        inline std::vector< Move > getPrincipalVariation( SearchContext const& ctx )
+        {
+            std::vector< Move > pv;
+
+            for ( int i = 0; i < ctx.pvLength[ 0 ]; ++i )
+            {
+                pv.push_back( toMove( ctx.pvTable[ 0 ][ i ] ) );
+            }
+
+            return pv;
+        }
+
+        struct IterationResult
+        {
+            MoveAndScore best;
+            int depth;
+            std::vector< Move > pv;
+        };
+
+        // Searches depth 0, 1, 2... until the limits run out and returns the deepest completed iteration
+        inline IterationResult iterativeDeepening( SearchContext& ctx, Position& pos, Limits limits, int firstDepth = 0 )
+        {
+            ctx.iteration = firstDepth;
+
+            IterationResult result = { searchRoot( ctx, pos, firstDepth ), firstDepth, getPrincipalVariation( ctx ) };
+
+            // a helper may have been stopped before finishing anything
+            if ( ctx.stopped )
+                return { result.best, -1, {} };
+
+            ctx.canStop = true;
+
+            auto const maxDepth = limits.depth > 0 ? limits.depth + 1 : MaxDepth;
+
+            for ( int depth = firstDepth + 1; depth < maxDepth; ++depth )
+            {
+                // the next iteration takes several times longer than this one, so don't start what can't finish
+                if ( !ctx.shared.isPondering() && ctx.shared.elapsed() * 2 > limits.seconds )
+                    break;
+
+                ctx.iteration = depth;
+
+                auto const best = aspirationSearch( ctx, pos, depth, result.best.score );
+
+                if ( ctx.stopped )
+                    break;
+
+                result = { best, depth, getPrincipalVariation( ctx ) };
+            }
+
+            return result;
+        }
+
+        struct ThreadResult
+        {
+            IterationResult iteration = { MoveAndScore( true ), -1, {} };
+            stats::Search stats;
+        };
+
+        /*
+            Lazy SMP: every helper runs its own iterative deepening on a private copy of the position,
+            and they only cooperate through the shared transposition table. Odd helpers start one ply
+            deeper so the threads don't all search the same depth in lockstep.
+        */
+        inline void helperSearch( SharedSearch& shared, Position pos, Limits limits, int threadIndex, ThreadResult& out )
+        {
+            SearchContext ctx( shared, threadIndex );
+
+            out.iteration = iterativeDeepening( ctx, pos, limits, threadIndex % 2 );
+            out.stats = ctx.stats;
+
+            ctx.publishNodes();
+        }
+    }
+
+    // Searches until the limits run out or stop is requested; the result of a stopped search is meaningless
+    inline SearchResult search( Position& pos, Limits limits, int threads, std::stop_token stop = {}, Ponder const* ponder = nullptr )
+    {
+        threads = std::max( threads, 1 );
+
+        details::SharedSearch shared( limits, threads, std::move( stop ), ponder );
+
+        std::vector< details::ThreadResult > results( threads );
+        std::vector< std::future< void > > helpers;
+
+        for ( int i = 1; i < threads; ++i )
+        {
+            // the position is copied now, before the main thread starts making moves on it
+            helpers.push_back( threadPool().submit( [&shared, pos, limits, i, &out = results[ i ]]
+            {
+                details::helperSearch( shared, pos, limits, i, out );
+            } ) );
+        }
+
+        {
+            details::SearchContext ctx( shared, 0 );
+
+            results[ 0 ].iteration = details::iterativeDeepening( ctx, pos, limits );
+            results[ 0 ].stats = ctx.stats;
+
+            ctx.publishNodes();
+        }
+
+        shared.stop = true;
+
+        for ( auto& helper : helpers )
+        {
+            threadPool().wait( helper );
+        }
+
+        // prefer the deepest completed iteration, and the main thread's when depths are equal
+        auto const best = std::max_element( results.begin(), results.end(), []( details::ThreadResult const& a, details::ThreadResult const& b )
+        {
+            return a.iteration.depth < b.iteration.depth;
+        } );
+
+        auto const& [bestMoveAndScore, depth, pv] = best->iteration;
+
+        stats::Search searchStats;
+
+        for ( auto const& r : results )
+        {
+            searchStats += r.stats;
+        }
+
+        searchStats.depth = depth;
+        searchStats.seconds = shared.elapsed();
+
+        return { bestMoveAndScore.move, bestMoveAndScore.score, depth, shared.totalNodes(), searchStats.seconds, searchStats, pv };
+    }
+
+    bool printNumberWithCommas( uint64_t n )
+    {
+        if ( n == 0 )
+            return false;
+
+        auto const comma = printNumberWithCommas( n / 1000 );
+
+        auto const remainder = static_cast< unsigned long long >( n % 1000 );
+
+        if ( comma )
+        {
+            printf(",%03llu", remainder );
+        }
+        else
+        {
+            printf("%llu", remainder );
+        }
+
+        return true;
+    };
+
+    namespace details
+    {
+        // A move from the opening book, if it has one for pos that can be played there
+        inline std::optional< Move > probeBook( Position& pos )
+        {
+            thread_local std::mt19937_64 rng( std::random_device{}() );
+
+            auto const m = book::openingBook.pick( pos.key, rng() );
+
+            if ( !m )
+                return std::nullopt;
+
+            // a different position with the same key would have different moves
+            MoveList moves;
+            generateMoves( pos, moves );
+
+            auto const found = std::find_if( moves.begin(), moves.end(), [m]( OrderedMove const& o ) { return o.move == *m; } );
+
+            if ( found == moves.end() )
+                return std::nullopt;
+
+            return toMove( *m );
+        }
+    }
+
+    // Chooses the ai's move in pos, which is searched on a copy
+    SearchResult makeMove( Position pos, Limits limits, std::stop_token stop = {}, Ponder const* ponder = nullptr )
+    {
+        auto const timeBefore = GetTime();
+
+        if ( auto const bookMove = details::probeBook( pos ) )
+        {
+            if ( !stop.stop_requested() )
+                std::cout << "Book move " << *bookMove << std::endl;
+
+            return { *bookMove, 0, 0, 0, GetTime() - timeBefore, {}, { *bookMove } };
+        }
+
+        transpositionTable.newSearch();
+
+        auto const result = search( pos, limits, threadCount, stop, ponder );
+
+        auto const timeAfter = GetTime();
+
+        if ( stop.stop_requested() )
+            return result;
+
+        std::cout << "Took " << timeAfter - timeBefore << "s to generate ";
+        printNumberWithCommas( result.nodes );
+        std::cout << " nodes (depth " << result.depth << ", pv";
+
+        for ( auto const& m : result.pv )
+        {
+            std::cout << ' ' << m;
+        }
+
+        std::cout << ")";
+
+        if ( compareWithMiniMax )
+        {
+            uint64_t miniMaxNodes = 0;
+
+            auto const miniMaxScore = details::miniMax< true >( pos, result.depth, miniMaxNodes );
+
+            // the minimax only adds up material along each line, so the scores are shown side by side
+            std::cout << " (minimax: ";
+            printNumberWithCommas( miniMaxNodes );
+            std::cout << " nodes, " << 100.0 - 100.0 * result.nodes / std::max< uint64_t >( miniMaxNodes, 1 ) << "% fewer, "
+                      << "score " << result.score << " vs " << miniMaxScore << ")";
+        }
+
+        std::cout << std::endl;
+
+        if ( printStats )
+            std::cout << result.stats;
+
+        return result;
     }
 }
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "Piece.h"
+#include "Bitboard.h"
+
+/*
+    Which squares each side attacks, kept up to date move by move so "is this square attacked" and
+    "is the king in check" are a bit test. A square's count is how many of the side's pieces attack
+    it, which is what lets a piece's attacks be taken off again without recomputing everyone else's.
+
+    The counts are bit sliced: plane n holds bit n of every square's count, so a whole set of squares
+    is counted up or down with a few bitboard operations rather than one square at a time.
+*/
+namespace attackmap
+{
+    // Enough for 31 attackers of a square, more than a side has pieces
+    constexpr int Planes = 5;
+
+    struct Map
+    {
+        // indexed by isAi() then plane
+        std::array< std::array< bitboard::Bitboard, Planes >, 2 > counts{};
+
+        // Every square the side attacks
+        constexpr bitboard::Bitboard attacked( bool byAi ) const
+        {
+            bitboard::Bitboard squares = 0;
+
+            for ( auto const plane : counts[ byAi ] )
+            {
+                squares |= plane;
+            }
+
+            return squares;
+        }
+
+        constexpr bool isAttacked( int16_t square, bool byAi ) const
+        {
+            return attacked( byAi ) & bitboard::squareBit( square );
+        }
+
+        constexpr int attackerCount( int16_t square, bool byAi ) const
+        {
+            int count = 0;
+
+            for ( int n = 0; n < Planes; ++n )
+            {
+                count |= static_cast< int >( ( counts[ byAi ][ n ] >> square ) & 1 ) << n;
+            }
+
+            return count;
+        }
+
+        static constexpr Map fromBoards( bitboard::Boards const& b )
+        {
+            Map m;
+
+            for ( auto pieces = b.occupied; pieces; )
+            {
+                auto const square = bitboard::popFirst( pieces );
+                auto const p = pieceOn( b, square );
+
+                m.add( p.isAi(), bitboard::attacksOf( p, square, b.occupied ) );
+            }
+
+            return m;
+        }
+
+        /*
+            Follows a move board::movePiece has made, b being the pieces after it: the moved piece's and
+            the captured piece's attacks come off, the sliders looking through either square are
+            lengthened or cut short, and moved, the piece now on dst, adds its own.
+        */
+        constexpr void onMove( bitboard::Boards const& b, int16_t fromIdx, int16_t dstIdx, Piece fromB4, Piece dstB4, Piece moved )
+        {
+            auto const after = b.occupied;
+            auto const before = beforeMove( after, fromIdx, dstIdx, dstB4 );
+
+            remove( fromB4.isAi(), bitboard::attacksOf( fromB4, fromIdx, before ) );
+
+            if ( !dstB4.isNull() )
+                remove( dstB4.isAi(), bitboard::attacksOf( dstB4, dstIdx, before ) );
+
+            moveRays( b, fromIdx, dstIdx, before, after );
+
+            add( moved.isAi(), bitboard::attacksOf( moved, dstIdx, after ) );
+        }
+
+        // Reverses onMove, b being the pieces once the move is undone
+        constexpr void onUndo( bitboard::Boards const& b, int16_t fromIdx, int16_t dstIdx, Piece fromB4, Piece dstB4, Piece moved )
+        {
+            auto const before = b.occupied;
+            auto const after = ( before & ~bitboard::squareBit( fromIdx ) ) | bitboard::squareBit( dstIdx );
+
+            remove( moved.isAi(), bitboard::attacksOf( moved, dstIdx, after ) );
+
+            moveRays( b, fromIdx, dstIdx, after, before );
+
+            if ( !dstB4.isNull() )
+                add( dstB4.isAi(), bitboard::attacksOf( dstB4, dstIdx, before ) );
+
+            add( fromB4.isAi(), bitboard::attacksOf( fromB4, fromIdx, before ) );
+        }
+
+        constexpr bool operator==( Map const& ) const = default;
+
+    private:
+        static constexpr bool isAiOn( bitboard::Boards const& b, int16_t square )
+        {
+            return b.sides[ true ] & bitboard::squareBit( square );
+        }
+
+        static constexpr Piece pieceOn( bitboard::Boards const& b, int16_t square )
+        {
+            auto const isAi = isAiOn( b, square );
+
+            for ( auto type = piece::Type::King; type != piece::Type::Null; ++type )
+            {
+                if ( b.of( isAi, type ) & bitboard::squareBit( square ) )
+                    return Piece{ !isAi, type };
+            }
+
+            return Piece{};
+        }
+
+        // The occupied squares before a move, given those after it
+        static constexpr bitboard::Bitboard beforeMove( bitboard::Bitboard after, int16_t fromIdx, int16_t dstIdx, Piece dstB4 )
+        {
+            auto const before = after | bitboard::squareBit( fromIdx );
+
+            return dstB4.isNull() ? before & ~bitboard::squareBit( dstIdx ) : before;
+        }
+
+        // Adds one to the count of each of the squares, carrying from plane to plane
+        constexpr void add( bool isAi, bitboard::Bitboard squares )
+        {
+            for ( auto& plane : counts[ isAi ] )
+            {
+                auto const carry = plane & squares;
+                plane ^= squares;
+                squares = carry;
+            }
+        }
+
+        // Takes one off the count of each of the squares, borrowing from plane to plane
+        constexpr void remove( bool isAi, bitboard::Bitboard squares )
+        {
+            for ( auto& plane : counts[ isAi ] )
+            {
+                auto const borrow = ~plane & squares;
+                plane ^= squares;
+                squares = borrow;
+            }
+        }
+
+        /*
+            Only sliders' attacks depend on the other pieces, and only those of the sliders that can see
+            a square that emptied or filled. They're found by looking out from those squares, and only
+            the squares their rays gained or lost are counted again. The pieces on fromIdx and dstIdx
+            are left to the caller.
+        */
+        constexpr void moveRays( bitboard::Boards const& b, int16_t fromIdx, int16_t dstIdx, bitboard::Bitboard from, bitboard::Bitboard to )
+        {
+            using enum piece::Type;
+
+            auto const skip = bitboard::squareBit( fromIdx ) | bitboard::squareBit( dstIdx );
+            auto const queens = b.of( false, Queen ) | b.of( true, Queen );
+            auto const diagonal = ( b.of( false, Bishop ) | b.of( true, Bishop ) | queens ) & ~skip;
+            auto const straight = ( b.of( false, Rook ) | b.of( true, Rook ) | queens ) & ~skip;
+
+            bitboard::Bitboard bishops = 0;
+            bitboard::Bitboard rooks = 0;
+
+            for ( auto changed = from ^ to; changed; )
+            {
+                auto const square = bitboard::popFirst( changed );
+
+                bishops |= bitboard::bishopAttacks( square, from ) & diagonal;
+                rooks |= bitboard::rookAttacks( square, from ) & straight;
+            }
+
+            // a queen seeing the square diagonally only changes along her diagonals, and the same for rooks
+            while ( bishops )
+            {
+                auto const square = bitboard::popFirst( bishops );
+                changeRays( isAiOn( b, square ), bitboard::bishopAttacks( square, from ), bitboard::bishopAttacks( square, to ) );
+            }
+
+            while ( rooks )
+            {
+                auto const square = bitboard::popFirst( rooks );
+                changeRays( isAiOn( b, square ), bitboard::rookAttacks( square, from ), bitboard::rookAttacks( square, to ) );
+            }
+        }
+
+        constexpr void changeRays( bool isAi, bitboard::Bitboard before, bitboard::Bitboard after )
+        {
+            remove( isAi, before & ~after );
+            add( isAi, after & ~before );
+        }
+    };
+}
@@ -0,0 +1,501 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+#include "AI.h"
+#include "Position.h"
+
+namespace bench
+{
+    // Positions with the ai (lower case) to move
+    constexpr std::array Positions = {
+        "rnbqkbnr/pppppppp/8/8/4P3/8/PPPP1PPP/RNBQKBNR b KQkq e3 0 1",
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R b KQkq - 0 1",
+        "r1bq1rk1/pp2bppp/2n1pn2/3p4/2PP4/2N1PN2/PP3PPP/R2QKB1R b KQ - 0 1",
+        "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 b - - 0 1",
+        "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 b - - 0 1",
+    };
+
+    struct Totals
+    {
+        uint64_t nodes = 0;
+        double seconds = 0;
+        ordering::Stats ordering;
+        std::vector< ai::SearchResult > results;
+    };
+
+    inline Totals searchAllPositions( ai::Limits limits, int threads )
+    {
+        Totals totals;
+
+        for ( auto const fen : Positions )
+        {
+            auto pos = Position::fromFen( fen );
+
+            // every run starts from an empty table so thread counts are compared fairly
+            ai::transpositionTable.clear();
+
+            auto const result = ai::search( pos, limits, threads );
+
+            totals.nodes += result.nodes;
+            totals.seconds += result.seconds;
+            totals.ordering += result.stats.ordering;
+            totals.results.push_back( result );
+        }
+
+        return totals;
+    }
+
+    // Time to reach a fixed depth on every bench position with 1, 2, 4... threads
+    inline void smpScaling( int depth, int maxThreads )
+    {
+        if ( maxThreads <= 0 )
+            maxThreads = std::max( 1u, std::thread::hardware_concurrency() );
+
+        // size the engine's pool before its first use so every helper gets its own worker
+        ai::threadCount = maxThreads;
+
+        ai::Limits const limits = { 1e9, 0, depth };
+
+        std::cout << "Lazy SMP scaling to depth " << depth << " over " << Positions.size() << " positions\n";
+
+        double baseline = 0;
+
+        for ( int threads = 1; ; threads = std::min( threads * 2, maxThreads ) )
+        {
+            auto const totals = searchAllPositions( limits, threads );
+
+            if ( threads == 1 )
+                baseline = totals.seconds;
+
+            std::cout << threads << " thread(s): " << totals.seconds << "s, "
+                      << totals.nodes << " nodes, "
+                      << static_cast< uint64_t >( totals.nodes / std::max( totals.seconds, 1e-9 ) ) << " nodes/s, "
+                      << "speedup " << baseline / std::max( totals.seconds, 1e-9 ) << "x\n";
+
+            if ( threads == maxThreads )
+                break;
+        }
+    }
+
+    // First-move cutoff rate and where cutoff moves came from, without and with the quiet move heuristics
+    inline void orderingHeuristics( int depth )
+    {
+        if constexpr ( !stats::Enabled )
+        {
+            std::cout << "--bench-ordering needs search statistics, which are compiled out\n";
+            return;
+        }
+
+        ai::Limits const limits = { 1e9, 0, depth };
+
+        std::cout << "Move ordering to depth " << depth << " over " << Positions.size() << " positions\n";
+
+        for ( auto const enabled : { false, true } )
+        {
+            ai::useOrderingHeuristics = enabled;
+
+            auto const totals = searchAllPositions( limits, 1 );
+            auto const& stats = totals.ordering;
+
+            std::cout << ( enabled ? "killer/history/counter: " : "generation order:       " )
+                      << totals.nodes << " nodes, "
+                      << stats.betaCutoffs << " cutoffs, "
+                      << 100.0 * stats.firstMoveCutoffRate() << "% on the first move (";
+
+            for ( size_t i = 0; i < stats.cutoffsBySource.size(); ++i )
+            {
+                std::cout << ( i ? ", " : "" ) << ordering::SourceNames[ i ] << " " << stats.cutoffsBySource[ i ];
+            }
+
+            std::cout << ")\n";
+        }
+    }
+
+    // Moves generated per node when every move is generated up front, and when they're generated a stage at a time
+    inline void stagedMoveGeneration( int depth )
+    {
+        if constexpr ( !stats::Enabled )
+        {
+            std::cout << "--bench-movegen needs search statistics, which are compiled out\n";
+            return;
+        }
+
+        ai::Limits const limits = { 1e9, 0, depth };
+
+        std::cout << "Move generation to depth " << depth << " over " << Positions.size() << " positions\n";
+
+        for ( auto const staged : { false, true } )
+        {
+            ai::useStagedMoveGeneration = staged;
+
+            auto const totals = searchAllPositions( limits, 1 );
+
+            std::cout << ( staged ? "staged:   " : "up front: " )
+                      << totals.nodes << " nodes, "
+                      << totals.ordering.movesGenerated << " moves generated, "
+                      << totals.ordering.movesGeneratedPerNode() << " per node that searched moves, "
+                      << totals.seconds << "s\n";
+        }
+    }
+
+    /*
+        Nodes and time to a fixed depth with no selective pruning, each technique on its own, and all
+        of them. How often the best move and score still match the unpruned search stands in for strength.
+    */
+    inline void selectivePruning( int depth )
+    {
+        ai::Limits const limits = { 1e9, 0, depth };
+
+        struct Config
+        {
+            const char* name;
+            ai::Pruning pruning;
+        };
+
+        constexpr std::array Configs = {
+            Config{ "none",       { false, false, false, false } },
+            Config{ "null move",  { true,  false, false, false } },
+            Config{ "lmr",        { false, true,  false, false } },
+            Config{ "futility",   { false, false, true,  false } },
+            Config{ "razoring",   { false, false, false, true  } },
+            Config{ "all",        { true,  true,  true,  true  } },
+        };
+
+        std::cout << "Selective pruning to depth " << depth << " over " << Positions.size() << " positions\n";
+
+        Totals baseline;
+
+        for ( auto const& config : Configs )
+        {
+            ai::pruning = config.pruning;
+
+            auto const totals = searchAllPositions( limits, 1 );
+
+            if ( &config == &Configs.front() )
+                baseline = totals;
+
+            int sameMove = 0;
+            double scoreDiff = 0;
+
+            for ( size_t i = 0; i < totals.results.size(); ++i )
+            {
+                auto const& a = totals.results[ i ].move;
+                auto const& b = baseline.results[ i ].move;
+
+                sameMove += a.from == b.from && a.dst == b.dst;
+                scoreDiff += std::abs( totals.results[ i ].score - baseline.results[ i ].score );
+            }
+
+            std::cout << config.name << ": " << totals.nodes << " nodes ("
+                      << 100.0 * totals.nodes / std::max< uint64_t >( baseline.nodes, 1 ) << "% of none), "
+                      << totals.seconds << "s, same best move in " << sameMove << "/" << totals.results.size()
+                      << ", mean score change " << scoreDiff / totals.results.size() << "\n";
+        }
+
+        ai::pruning = {};
+    }
+
+    /*
+        How long an unlimited search takes to return after its stop is requested, on every bench
+        position and after a few different amounts of searching.
+    */
+    inline void cancellation( int threads )
+    {
+        ai::threadCount = threads;
+
+        ai::Limits const limits = { 1e9 };
+
+        std::cout << "Cancellation latency with " << threads << " thread(s) over " << Positions.size() << " positions\n";
+
+        double total = 0;
+        double worst = 0;
+        int count = 0;
+
+        for ( auto const fen : Positions )
+        {
+            for ( auto const searchFor : { 5, 50, 250 } )
+            {
+                std::stop_source stop;
+
+                auto result = ai::threadPool().submit( [pos = Position::fromFen( fen ), limits, threads, token = stop.get_token()]() mutable
+                {
+                    return ai::search( pos, limits, threads, token );
+                } );
+
+                std::this_thread::sleep_for( std::chrono::milliseconds( searchFor ) );
+
+                auto const before = std::chrono::steady_clock::now();
+
+                stop.request_stop();
+                result.wait();
+
+                auto const latency = std::chrono::duration< double, std::milli >( std::chrono::steady_clock::now() - before ).count();
+
+                total += latency;
+                worst = std::max( worst, latency );
+                count += 1;
+            }
+        }
+
+        std::cout << "mean " << total / count << "ms, worst " << worst << "ms\n";
+    }
+
+    namespace details
+    {
+        // Leaf nodes of the move tree to depth. generate( pos, moves ) fills in the legal moves of a position
+        template< class Generate >
+        uint64_t perft( Position& pos, int depth, Generate const& generate )
+        {
+            MoveList moves;
+            generate( pos, moves );
+
+            if ( depth <= 1 )
+                return moves.size();
+
+            uint64_t nodes = 0;
+
+            for ( auto const& [m, _] : moves )
+            {
+                auto const undo = board::movePiece( pos, m.from(), m.dst(), m.promotion() );
+
+                nodes += perft( pos, depth - 1, generate );
+
+                board::undoMove( pos, m.from(), m.dst(), undo );
+            }
+
+            return nodes;
+        }
+
+        // The standard perft positions and their published node counts at depth 1, 2, 3...
+        struct PerftPosition
+        {
+            const char* fen;
+            std::array< uint64_t, 5 > nodes;
+        };
+
+        // between them they castle, take en passant, promote to every piece and have pins and checks of every kind
+        constexpr std::array PerftPositions = {
+            PerftPosition{ "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",                 { 20, 400, 8902, 197281, 4865609 } },
+            PerftPosition{ "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",     { 48, 2039, 97862, 4085603, 193690690 } },
+            PerftPosition{ "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",                                { 14, 191, 2812, 43238, 674624 } },
+            PerftPosition{ "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",         { 6, 264, 9467, 422333, 15833292 } },
+            PerftPosition{ "r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1",         { 6, 264, 9467, 422333, 15833292 } },
+            PerftPosition{ "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",                { 44, 1486, 62379, 2103487, 89941194 } },
+            PerftPosition{ "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10", { 46, 2079, 89890, 3894594, 164075551 } },
+        };
+
+        // Checks the search's move generation against the published counts, to depth or as deep as they go
+        inline bool perftSuite( int depth )
+        {
+            std::cout << "Perft of " << PerftPositions.size() << " test positions to depth " << depth << "\n";
+
+            auto const before = std::chrono::steady_clock::now();
+            uint64_t total = 0;
+            auto allMatch = true;
+
+            for ( auto const& [fen, known] : PerftPositions )
+            {
+                auto pos = Position::fromFen( fen );
+
+                for ( int d = 1; d <= std::min( depth, static_cast< int >( known.size() ) ); ++d )
+                {
+                    auto const nodes = perft( pos, d, []( Position& pos, MoveList& moves ) { ai::details::generateMoves( pos, moves ); } );
+
+                    total += nodes;
+
+                    if ( nodes != known[ d - 1 ] )
+                    {
+                        std::cout << fen << " at depth " << d << ": " << nodes << " nodes, not " << known[ d - 1 ] << "\n";
+                        allMatch = false;
+                    }
+                }
+            }
+
+            std::chrono::duration< double > const seconds = std::chrono::steady_clock::now() - before;
+
+            std::cout << ( allMatch ? "every count matches, " : "" ) << total << " nodes, " << seconds.count() << "s\n";
+
+            return allMatch;
+        }
+    }
+
+    /*
+        Checks the node counts of the standard perft positions, then compares move generation on the
+        squares alone against generation from the bitboards: perft to a fixed depth from the starting
+        position and the bench positions. The node counts have to agree; false if any don't.
+    */
+    inline bool perft( int depth )
+    {
+        if ( !details::perftSuite( depth ) )
+            return false;
+
+        std::vector< Position > positions = { Position::startPosition() };
+
+        for ( auto const fen : Positions )
+        {
+            positions.push_back( Position::fromFen( fen ) );
+        }
+
+        std::cout << "Perft to depth " << depth << " over " << positions.size() << " positions\n";
+
+        auto const run = [&positions, depth]( const char* name, auto generate )
+        {
+            std::vector< uint64_t > counts;
+            uint64_t nodes = 0;
+
+            auto const before = std::chrono::steady_clock::now();
+
+            for ( auto pos : positions )
+            {
+                counts.push_back( details::perft( pos, depth, generate ) );
+                nodes += counts.back();
+            }
+
+            std::chrono::duration< double > const seconds = std::chrono::steady_clock::now() - before;
+
+            std::cout << name << nodes << " nodes, " << seconds.count() << "s, "
+                      << static_cast< uint64_t >( nodes / std::max( seconds.count(), 1e-9 ) ) << " nodes/s\n";
+
+            return std::pair{ counts, seconds.count() };
+        };
+
+        // the squares only give the moves the pieces can make, so those leaving the king attacked are tried and dropped
+        auto const [squareCounts, squareSeconds] = run( "squares:   ", []( Position& pos, MoveList& moves )
+        {
+            MoveList pseudoLegal;
+            ai::details::generateMoves( pos.board.data(), pos.aiToMove, pos.castling, pos.enPassant, pseudoLegal );
+
+            for ( auto const& m : pseudoLegal )
+            {
+                auto b = pos.board;
+                board::movePiece( b.data(), m.move.from(), m.move.dst(), m.move.promotion() );
+
+                auto const boards = bitboard::Boards::fromBoard( b.data() );
+                auto const king = boards.of( pos.aiToMove, piece::Type::King );
+
+                if ( !bitboard::isAttacked( boards, bitboard::first( king ), !pos.aiToMove ) )
+                    moves.push_back( m );
+            }
+        } );
+
+        auto const [bitboardCounts, bitboardSeconds] = run( "bitboards: ", []( Position& pos, MoveList& moves )
+        {
+            ai::details::generateMoves( pos, moves );
+        } );
+
+        if ( squareCounts != bitboardCounts )
+        {
+            std::cout << "The node counts differ\n";
+            return false;
+        }
+
+        std::cout << "speedup " << squareSeconds / std::max( bitboardSeconds, 1e-9 ) << "x\n";
+
+        return true;
+    }
+
+    /*
+        Evaluations per second of the material count the search started out with, the incremental
+        piece-square evaluation and the network, over positions reached by random play from the bench
+        positions. Without a network file the network has random weights, which evaluate just as fast.
+        False if the network doesn't load or evaluates wrongly.
+    */
+    inline bool nnueEvaluation( const char* path )
+    {
+        nnue::network = path ? nnue::Network::load( path ) : nnue::Network::random( 1 );
+
+        if ( !nnue::network )
+            return false;
+
+        std::vector< Position > positions;
+        std::mt19937 rng( 1 );
+
+        for ( auto const fen : Positions )
+        {
+            auto pos = Position::fromFen( fen );
+
+            for ( int ply = 0; ply < 400; ++ply )
+            {
+                MoveList moves;
+                ai::details::generateMoves( pos, moves );
+
+                if ( moves.empty() )
+                    break;
+
+                auto const m = moves[ std::uniform_int_distribution< size_t >( 0, moves.size() - 1 )( rng ) ].move;
+                board::movePiece( pos, m.from(), m.dst(), m.promotion() );
+
+                positions.push_back( pos );
+            }
+        }
+
+        // the incremental updates have to agree with a refresh, and the vector kernels with the scalar ones
+        for ( auto const& pos : positions )
+        {
+            if ( !( pos.nnue == nnue::Accumulator::fromBoard( *nnue::network, pos.board.data() ) )
+              || nnue::evaluate< true >( *nnue::network, pos.nnue, pos.aiToMove ) != nnue::evaluate< false >( *nnue::network, pos.nnue, pos.aiToMove ) )
+            {
+                std::cout << "The network's incremental or vectorised evaluation is wrong\n";
+                return false;
+            }
+        }
+
+        std::cout << "Evaluation speed over " << positions.size() << " positions, " << ( path ? path : "random network" )
+                  << ", " << nnue::Instructions << " kernels\n";
+
+        constexpr int Repeats = 200;
+
+        auto const measure = [&positions]( const char* name, auto evaluate )
+        {
+            int64_t sum = 0;
+
+            auto const before = std::chrono::steady_clock::now();
+
+            for ( int r = 0; r < Repeats; ++r )
+            {
+                for ( auto const& pos : positions )
+                {
+                    sum += evaluate( pos );
+                }
+            }
+
+            std::chrono::duration< double > const seconds = std::chrono::steady_clock::now() - before;
+
+            std::cout << name << static_cast< uint64_t >( Repeats * positions.size() / seconds.count() ) << " evals/s (checksum " << sum << ")\n";
+        };
+
+        measure( "material:              ", []( Position const& pos )
+        {
+            int score = 0;
+
+            for ( auto type = piece::Type::King; type != piece::Type::Null; ++type )
+            {
+                auto const difference = bitboard::count( pos.bitboards.of( pos.aiToMove, type ) ) - bitboard::count( pos.bitboards.of( !pos.aiToMove, type ) );
+
+                score += difference * evaluation::PieceValues[ type ];
+            }
+
+            return score;
+        } );
+
+        measure( "piece-square tables:   ", []( Position const& pos ) { return evaluation::evaluate( pos.eval, pos.aiToMove ); } );
+        measure( "network, scalar:       ", []( Position const& pos ) { return nnue::evaluate< false >( *nnue::network, pos.nnue, pos.aiToMove ); } );
+        measure( "network:               ", []( Position const& pos ) { return nnue::evaluate( *nnue::network, pos.nnue, pos.aiToMove ); } );
+        measure( "network from scratch:  ", []( Position const& pos )
+        {
+            return nnue::evaluate( *nnue::network, nnue::Accumulator::fromBoard( *nnue::network, pos.board.data() ), pos.aiToMove );
+        } );
+
+        nnue::network.reset();
+
+        return true;
+    }
+}
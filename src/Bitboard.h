@@ -0,0 +1,497 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+
+#if defined( CHESS_PEXT )
+#if !defined( __BMI2__ )
+#error "CHESS_PEXT needs a BMI2 target, e.g. -mbmi2"
+#endif
+#include <immintrin.h>
+#endif
+
+#include "Piece.h"
+#include "Move.h"
+#include "board.h"
+
+/*
+    Sets of squares in a uint64_t, bit n standing for board index n: bit 0 is the ai's back left
+    corner and bit 63 the user's back right. Moving Down the board adds 8 to the index.
+*/
+namespace bitboard
+{
+    using Bitboard = uint64_t;
+
+    constexpr Bitboard squareBit( int16_t index )
+    {
+        return Bitboard( 1 ) << index;
+    }
+
+    constexpr int count( Bitboard b )
+    {
+        return std::popcount( b );
+    }
+
+    // The lowest square in a non-empty set
+    constexpr int16_t first( Bitboard b )
+    {
+        return static_cast< int16_t >( std::countr_zero( b ) );
+    }
+
+    // Removes the lowest square from a non-empty set and returns it
+    constexpr int16_t popFirst( Bitboard& b )
+    {
+        auto const square = first( b );
+        b &= b - 1;
+        return square;
+    }
+
+    // The ai's back row, where the user's pawns promote, and the user's, where the ai's do
+    constexpr Bitboard TopRow    = 0x00000000000000ffull;
+    constexpr Bitboard BottomRow = 0xff00000000000000ull;
+
+    // Where a pawn of the side promotes, indexed by isAi
+    constexpr std::array< Bitboard, 2 > PromotionRows = { TopRow, BottomRow };
+
+    // One square towards the other side for each square of the set, indexed by isAi
+    constexpr Bitboard pawnPush( Bitboard b, bool isAi )
+    {
+        return isAi ? b << 8 : b >> 8;
+    }
+
+    namespace details
+    {
+        // The squares one of the moves reaches from each square
+        template< size_t N >
+        consteval std::array< Bitboard, 64 > makeStepAttacks( std::array< Move, N > const& moves )
+        {
+            std::array< Bitboard, 64 > attacks{};
+
+            for ( int16_t square = 0; square < 64; ++square )
+            {
+                for ( auto const& m : moves )
+                {
+                    auto const dst = board::indexToCoords( square ) + m.direction;
+
+                    if ( !board::isOutOfBounds( dst ) )
+                        attacks[ square ] |= squareBit( board::coordsToIndex( dst ) );
+                }
+            }
+
+            return attacks;
+        }
+
+        // For each direction of move::QueenMoves and each square, every square out to the edge of the board
+        consteval std::array< std::array< Bitboard, 64 >, 8 > makeRays()
+        {
+            std::array< std::array< Bitboard, 64 >, 8 > rays{};
+
+            for ( size_t d = 0; d < move::QueenMoves.size(); ++d )
+            {
+                for ( int16_t square = 0; square < 64; ++square )
+                {
+                    auto coords = board::indexToCoords( square ) + move::QueenMoves[ d ].direction;
+
+                    for ( ; !board::isOutOfBounds( coords ); coords = coords + move::QueenMoves[ d ].direction )
+                    {
+                        rays[ d ][ square ] |= squareBit( board::coordsToIndex( coords ) );
+                    }
+                }
+            }
+
+            return rays;
+        }
+
+        inline constexpr auto Rays = makeRays();
+
+        // Directions that move to higher indices find their first blocker with the lowest set bit, the others with the highest
+        consteval std::array< bool, 8 > makeRayIncreases()
+        {
+            std::array< bool, 8 > increases{};
+
+            for ( size_t d = 0; d < move::QueenMoves.size(); ++d )
+            {
+                auto const direction = move::QueenMoves[ d ].direction;
+                increases[ d ] = direction.j * 8 + direction.i > 0;
+            }
+
+            return increases;
+        }
+
+        inline constexpr auto RayIncreases = makeRayIncreases();
+
+        // The ray up to and including the first occupied square
+        constexpr Bitboard rayAttacks( size_t direction, int16_t square, Bitboard occupied )
+        {
+            auto const ray = Rays[ direction ][ square ];
+            auto const blockers = ray & occupied;
+
+            if ( !blockers )
+                return ray;
+
+            auto const blocker = RayIncreases[ direction ] ? first( blockers ) : static_cast< int16_t >( 63 - std::countl_zero( blockers ) );
+
+            return ray ^ Rays[ direction ][ blocker ];
+        }
+    }
+
+    inline constexpr auto KnightAttacks = details::makeStepAttacks( move::KnightMoves );
+    inline constexpr auto KingAttacks   = details::makeStepAttacks( move::KingMoves );
+
+    namespace details
+    {
+        // For two squares on a line, the squares strictly between them, or the whole line through both
+        consteval std::array< std::array< Bitboard, 64 >, 64 > makeLines( bool between )
+        {
+            std::array< std::array< Bitboard, 64 >, 64 > lines{};
+
+            for ( size_t d = 0; d < move::QueenMoves.size(); ++d )
+            {
+                size_t opposite = 0;
+
+                while ( !( move::QueenMoves[ opposite ].direction == move::QueenMoves[ d ].direction * -1 ) )
+                {
+                    ++opposite;
+                }
+
+                for ( int16_t square = 0; square < 64; ++square )
+                {
+                    for ( auto ray = Rays[ d ][ square ]; ray; )
+                    {
+                        auto const other = popFirst( ray );
+
+                        lines[ square ][ other ] = between
+                            ? Rays[ d ][ square ] & ~Rays[ d ][ other ] & ~squareBit( other )
+                            : Rays[ d ][ square ] | Rays[ opposite ][ square ] | squareBit( square );
+                    }
+                }
+            }
+
+            return lines;
+        }
+    }
+
+    // Indexed by two squares, empty unless they share a rank, file or diagonal
+    inline constexpr auto Between = details::makeLines( true );
+    inline constexpr auto Line    = details::makeLines( false );
+
+    // The squares a pawn of the side attacks from each square, indexed by isAi. The ai's pawns are white and move down
+    inline constexpr std::array PawnAttacks = {
+        details::makeStepAttacks( move::BlackPawnAttacks ),
+        details::makeStepAttacks( move::WhitePawnAttacks )
+    };
+
+    // The square in front of a pawn of the side, indexed by isAi
+    inline constexpr std::array PawnPushes = {
+        details::makeStepAttacks( move::BlackPawnMoves ),
+        details::makeStepAttacks( move::WhitePawnMoves )
+    };
+
+    namespace details
+    {
+        // move::RookMoves are the first four directions of move::QueenMoves, and the bishop's the last four
+        constexpr size_t RookDirections = 0;
+        constexpr size_t BishopDirections = 4;
+
+        // All four rays of a rook or bishop, stepped out one at a time
+        constexpr Bitboard slidingAttacks( size_t firstDirection, int16_t square, Bitboard occupied )
+        {
+            return rayAttacks( firstDirection, square, occupied ) | rayAttacks( firstDirection + 1, square, occupied )
+                 | rayAttacks( firstDirection + 2, square, occupied ) | rayAttacks( firstDirection + 3, square, occupied );
+        }
+
+        /*
+            The squares whose occupancy can change a slider's attacks from each square: its rays without
+            their last square, as a piece on the edge of the board has nothing behind it to block.
+        */
+        consteval std::array< Bitboard, 64 > makeRelevantMasks( size_t firstDirection )
+        {
+            std::array< Bitboard, 64 > masks{};
+
+            for ( int16_t square = 0; square < 64; ++square )
+            {
+                for ( auto d = firstDirection; d < firstDirection + 4; ++d )
+                {
+                    auto const ray = Rays[ d ][ square ];
+
+                    if ( !ray )
+                        continue;
+
+                    auto const last = RayIncreases[ d ] ? 63 - std::countl_zero( ray ) : std::countr_zero( ray );
+
+                    masks[ square ] |= ray & ~squareBit( static_cast< int16_t >( last ) );
+                }
+            }
+
+            return masks;
+        }
+
+        inline constexpr auto RookMasks = makeRelevantMasks( RookDirections );
+        inline constexpr auto BishopMasks = makeRelevantMasks( BishopDirections );
+    }
+
+    namespace details
+    {
+        // Found by trying sparse random numbers until every blocker set of the square hashed to an entry holding its attacks
+        inline constexpr std::array< uint64_t, 64 > RookMagics = {
+            0x1080008040001020ull, 0x0540002000401001ull, 0x0200091220420080ull, 0x1280100018014480ull,
+            0x3001000810208040ull, 0x0300090002040008ull, 0x0280030002000080ull, 0x2180002480004100ull,
+            0x0014800420400080ull, 0x0024802000804004ull, 0x0a10801000200080ull, 0x0422001008204200ull,
+            0x2120800400800800ull, 0x2800808002000400ull, 0x1091000401000200ull, 0x0020802041000080ull,
+            0x8080024000200042ull, 0x1010004040002000ull, 0x0a00808010002000ull, 0x0401050010002008ull,
+            0x8810808008000400ull, 0x2000880140041020ull, 0x40800400014210a8ull, 0x0001020010840041ull,
+            0x1240004680008021ull, 0x4101d00140002001ull, 0x4800200080801000ull, 0x0000100280080081ull,
+            0x0188008080080400ull, 0x0204010040400200ull, 0x4004d00400120821ull, 0x0842004200108114ull,
+            0xd000400080800032ull, 0x8040080020201002ull, 0x2000200411004100ull, 0x020300620b001000ull,
+            0x2201000801000410ull, 0x008a001002000804ull, 0x0050020001010004ull, 0x00440490c2002904ull,
+            0x0910400121818000ull, 0x20a0004030024000ull, 0x0000102001010044ull, 0x03504201a0120008ull,
+            0x0004000800808004ull, 0x0018040002008080ull, 0x1400100182040048ull, 0x0800008041220004ull,
+            0x2004820021430600ull, 0x2000400080200180ull, 0x0030040020080120ull, 0xa214800800100080ull,
+            0x0006d00501280100ull, 0x1065800400020180ull, 0x0404800100020080ull, 0x0080010c00488200ull,
+            0x124c210010800043ull, 0x0000201200450082ull, 0x000301c249502001ull, 0x0800100004082101ull,
+            0x4002001008042002ull, 0x0046000824500122ull, 0x0c02002801440082ull, 0x0800004100208c02ull
+        };
+
+        inline constexpr std::array< uint64_t, 64 > BishopMagics = {
+            0x2011010a00820204ull, 0x0402228401020014ull, 0x0010010a08200000ull, 0x00082088200800a0ull,
+            0x002450c000082080ull, 0x6002012420880200ull, 0x2022008220100010ull, 0x8000210108200210ull,
+            0xa008082044008201ull, 0x0010021021010100ull, 0x0008280230421001ull, 0x02108404088c0040ull,
+            0x4400011040008088ull, 0x8600011022100000ull, 0x14a4212410020900ull, 0x00004022280c1424ull,
+            0x1308044008810409ull, 0x90448c2008020063ull, 0x040c001218005500ull, 0xe00a400401020208ull,
+            0x40140000942000c2ull, 0x0002020900a08405ull, 0x20e9041401011000ull, 0x160c800104008285ull,
+            0x0211102004200208ull, 0x0122100408210800ull, 0x30020208c4480a00ull, 0x0102002102008200ull,
+            0x8101001107004000ull, 0x0008002302008401ull, 0x3000808404020801ull, 0x0974004480210400ull,
+            0x0059201109220400ull, 0x0802a460001c0822ull, 0x100041d0040802a0ull, 0x00a0420280180080ull,
+            0x0241100400008020ull, 0x0060048208910102ull, 0x22610200a0a20802ull, 0x1008660040808040ull,
+            0x2004100308101102ull, 0x4061080110408420ull, 0x0083040201044202ull, 0x12a1714200820800ull,
+            0x0029403008800100ull, 0x0072049000812100ull, 0x4030112840890900ull, 0x0c88285282202080ull,
+            0x001c010410054000ull, 0x0206008241500008ull, 0x980401240a480800ull, 0x0140000084241120ull,
+            0x010080900202100cull, 0x0250403002488180ull, 0x0220040908292084ull, 0x0c05440084010042ull,
+            0x2002020111013080ull, 0x2000010080904808ull, 0x1890080202010430ull, 0x0040810002104402ull,
+            0x2429202920034408ull, 0x0804040448302100ull, 0x0122d00228482480ull, 0x0102080a40860200ull
+        };
+
+        // A square's blocker sets, one table entry each
+        consteval size_t countEntries( std::array< Bitboard, 64 > const& masks )
+        {
+            size_t entries = 0;
+
+            for ( auto const mask : masks )
+            {
+                entries += size_t( 1 ) << count( mask );
+            }
+
+            return entries;
+        }
+
+        // Where a square's attacks start in the table, and how its blockers pick one
+        struct SliderSquare
+        {
+            Bitboard mask;
+            uint64_t magic;
+            uint32_t offset;
+            uint8_t shift;
+
+            size_t index( Bitboard occupied ) const
+            {
+#if defined( CHESS_PEXT )
+                return offset + _pext_u64( occupied, mask );
+#else
+                return offset + ( ( occupied & mask ) * magic >> shift );
+#endif
+            }
+        };
+
+        /*
+            The attacks of a rook and a bishop from every square with every set of blockers, filled in
+            once at startup. The blockers on a square's rays are hashed to its entries by multiplying
+            with the square's magic, or with CHESS_PEXT packed together by the BMI2 instruction, so a
+            lookup is a single read.
+        */
+        class SliderTables
+        {
+        public:
+            SliderTables()
+            {
+                auto const offset = fill( m_rooks, RookMasks, RookMagics, RookDirections, 0 );
+                fill( m_bishops, BishopMasks, BishopMagics, BishopDirections, offset );
+            }
+
+            Bitboard rook( int16_t square, Bitboard occupied ) const
+            {
+                return m_attacks[ m_rooks[ square ].index( occupied ) ];
+            }
+
+            Bitboard bishop( int16_t square, Bitboard occupied ) const
+            {
+                return m_attacks[ m_bishops[ square ].index( occupied ) ];
+            }
+
+        private:
+            // Returns the offset after the last square's entries
+            uint32_t fill( std::array< SliderSquare, 64 >& squares, std::array< Bitboard, 64 > const& masks,
+                           std::array< uint64_t, 64 > const& magics, size_t firstDirection, uint32_t offset )
+            {
+                for ( int16_t square = 0; square < 64; ++square )
+                {
+                    auto const mask = masks[ square ];
+                    squares[ square ] = { mask, magics[ square ], offset, static_cast< uint8_t >( 64 - count( mask ) ) };
+
+                    // every subset of the mask, counting up through its bits
+                    Bitboard blockers = 0;
+
+                    do
+                    {
+                        auto& entry = m_attacks[ squares[ square ].index( blockers ) ];
+                        auto const attacks = slidingAttacks( firstDirection, square, blockers );
+
+                        // a slider always attacks something, so an empty entry is unused
+                        assert( entry == 0 || entry == attacks );
+
+                        entry = attacks;
+                        blockers = ( blockers - mask ) & mask;
+                    } while ( blockers );
+
+                    offset += uint32_t( 1 ) << count( mask );
+                }
+
+                return offset;
+            }
+
+            std::array< SliderSquare, 64 > m_rooks;
+            std::array< SliderSquare, 64 > m_bishops;
+            std::array< Bitboard, countEntries( RookMasks ) + countEntries( BishopMasks ) > m_attacks{};
+        };
+
+        inline SliderTables const sliderTables;
+    }
+
+    // Looked up in the tables, or stepped out ray by ray when evaluated at compile time
+    constexpr Bitboard rookAttacks( int16_t square, Bitboard occupied )
+    {
+        if consteval
+        {
+            return details::slidingAttacks( details::RookDirections, square, occupied );
+        }
+        else
+        {
+            return details::sliderTables.rook( square, occupied );
+        }
+    }
+
+    constexpr Bitboard bishopAttacks( int16_t square, Bitboard occupied )
+    {
+        if consteval
+        {
+            return details::slidingAttacks( details::BishopDirections, square, occupied );
+        }
+        else
+        {
+            return details::sliderTables.bishop( square, occupied );
+        }
+    }
+
+    constexpr Bitboard queenAttacks( int16_t square, Bitboard occupied )
+    {
+        return rookAttacks( square, occupied ) | bishopAttacks( square, occupied );
+    }
+
+    // The squares the piece attacks from square, which for a pawn are only its captures
+    constexpr Bitboard attacksOf( Piece p, int16_t square, Bitboard occupied )
+    {
+        using enum piece::Type;
+
+        switch ( p.type )
+        {
+        case King:   return KingAttacks[ square ];
+        case Queen:  return queenAttacks( square, occupied );
+        case Bishop: return bishopAttacks( square, occupied );
+        case Knight: return KnightAttacks[ square ];
+        case Rook:   return rookAttacks( square, occupied );
+        case Pawn:   return PawnAttacks[ p.isAi() ][ square ];
+        case Null:   break;
+        }
+
+        return 0;
+    }
+
+    /*
+        Where every piece is: a set per side and type, each side's pieces and all of them. Kept next
+        to the board's squares, which answer "what is on this square" without a search.
+    */
+    struct Boards
+    {
+        // indexed by isAi() then type
+        std::array< std::array< Bitboard, 6 >, 2 > pieces{};
+        std::array< Bitboard, 2 > sides{};
+        Bitboard occupied = 0;
+
+        constexpr Bitboard of( bool isAi, piece::Type type ) const
+        {
+            return pieces[ isAi ][ type ];
+        }
+
+        // Adds the piece to the square, or takes it off if it's there. Null pieces change nothing
+        constexpr void toggle( Piece p, int16_t square )
+        {
+            if ( p.isNull() )
+                return;
+
+            auto const bit = squareBit( square );
+
+            pieces[ p.isAi() ][ p.type ] ^= bit;
+            sides[ p.isAi() ] ^= bit;
+            occupied ^= bit;
+        }
+
+        static constexpr Boards fromBoard( Piece const* board )
+        {
+            Boards b;
+
+            for ( int16_t i = 0; i < 64; ++i )
+            {
+                b.toggle( board[ i ], i );
+            }
+
+            return b;
+        }
+
+        constexpr bool operator==( Boards const& ) const = default;
+    };
+
+    // Every piece of either side attacking the square, with sliders blocked by occupied rather than the board
+    constexpr Bitboard attackersOf( Boards const& b, int16_t square, Bitboard occupied )
+    {
+        using enum piece::Type;
+
+        auto const diagonal = b.of( false, Bishop ) | b.of( true, Bishop ) | b.of( false, Queen ) | b.of( true, Queen );
+        auto const straight = b.of( false, Rook ) | b.of( true, Rook ) | b.of( false, Queen ) | b.of( true, Queen );
+
+        // a pawn attacks the square from where a pawn of the other side on the square would attack
+        return ( PawnAttacks[ false ][ square ] & b.of( true, Pawn ) )
+             | ( PawnAttacks[ true ][ square ] & b.of( false, Pawn ) )
+             | ( KnightAttacks[ square ] & ( b.of( false, Knight ) | b.of( true, Knight ) ) )
+             | ( KingAttacks[ square ] & ( b.of( false, King ) | b.of( true, King ) ) )
+             | ( bishopAttacks( square, occupied ) & diagonal )
+             | ( rookAttacks( square, occupied ) & straight );
+    }
+
+    // Where a pawn of the side on square can go: one or two squares forward if they're empty, or a capture
+    constexpr Bitboard pawnTargets( Boards const& b, int16_t square, bool isAi )
+    {
+        auto pushes = PawnPushes[ isAi ][ square ] & ~b.occupied;
+
+        if ( pushes && board::isPawnStartingPosition( square, isAi ) )
+            pushes |= PawnPushes[ isAi ][ first( pushes ) ] & ~b.occupied;
+
+        return pushes | ( PawnAttacks[ isAi ][ square ] & b.sides[ !isAi ] );
+    }
+
+    // Whether any piece of the given side attacks the square
+    constexpr bool isAttacked( Boards const& b, int16_t square, bool byAi )
+    {
+        return attackersOf( b, square, b.occupied ) & b.sides[ byAi ];
+    }
+}
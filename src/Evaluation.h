@@ -0,0 +1,214 @@
+#pragma once
+
+#include <array>
+#include <algorithm>
+#include <cstdint>
+
+#include "Piece.h"
+#include "Bitboard.h"
+
+namespace evaluation
+{
+    // Material, in the same units as the search's capture scores. Losing the king loses the game
+    constexpr std::array PieceValues = {
+        50000, // king
+        45, // queen
+        15, // bishop
+        15, // knight
+        25, // rook
+        5, // pawn
+    };
+
+    // The ai values the user's pieces this much more than its own, so it is happy to trade
+    constexpr int Aggressiveness = 4;
+
+    // How much each piece counts towards the middle game. Below MaxPhase the endgame tables take over
+    constexpr std::array PhaseWeights = { 0, 4, 1, 1, 2, 0 };
+    constexpr int MaxPhase = 24;
+
+    using Table = std::array< int8_t, 64 >;
+
+    /*
+        Bonuses by square, laid out as the user sees the board: the user's pieces start on the bottom
+        two rows and move up. The ai's pieces look up the square mirrored top to bottom.
+    */
+    namespace tables
+    {
+        constexpr Table PawnMiddleGame = {
+             0,  0,  0,  0,  0,  0,  0,  0,
+             5,  5,  5,  5,  5,  5,  5,  5,
+             1,  1,  2,  3,  3,  2,  1,  1,
+             0,  0,  1,  3,  3,  1,  0,  0,
+             0,  0,  0,  2,  2,  0,  0,  0,
+             0,  0,  0,  0,  0,  0,  0,  0,
+             0,  0,  0, -2, -2,  0,  0,  0,
+             0,  0,  0,  0,  0,  0,  0,  0,
+        };
+
+        constexpr Table PawnEndGame = {
+             0,  0,  0,  0,  0,  0,  0,  0,
+             8,  8,  8,  8,  8,  8,  8,  8,
+             5,  5,  5,  5,  5,  5,  5,  5,
+             3,  3,  3,  3,  3,  3,  3,  3,
+             2,  2,  2,  2,  2,  2,  2,  2,
+             1,  1,  1,  1,  1,  1,  1,  1,
+             0,  0,  0,  0,  0,  0,  0,  0,
+             0,  0,  0,  0,  0,  0,  0,  0,
+        };
+
+        constexpr Table Knight = {
+            -5, -4, -3, -3, -3, -3, -4, -5,
+            -4, -2,  0,  0,  0,  0, -2, -4,
+            -3,  0,  1,  2,  2,  1,  0, -3,
+            -3,  0,  2,  3,  3,  2,  0, -3,
+            -3,  0,  2,  3,  3,  2,  0, -3,
+            -3,  0,  1,  2,  2,  1,  0, -3,
+            -4, -2,  0,  0,  0,  0, -2, -4,
+            -5, -4, -3, -3, -3, -3, -4, -5,
+        };
+
+        constexpr Table Bishop = {
+            -2, -1, -1, -1, -1, -1, -1, -2,
+            -1,  0,  0,  0,  0,  0,  0, -1,
+            -1,  0,  1,  1,  1,  1,  0, -1,
+            -1,  1,  1,  1,  1,  1,  1, -1,
+            -1,  0,  1,  1,  1,  1,  0, -1,
+            -1,  1,  1,  1,  1,  1,  1, -1,
+            -1,  1,  0,  0,  0,  0,  1, -1,
+            -2, -1, -1, -1, -1, -1, -1, -2,
+        };
+
+        constexpr Table Rook = {
+             0,  0,  0,  0,  0,  0,  0,  0,
+             1,  2,  2,  2,  2,  2,  2,  1,
+            -1,  0,  0,  0,  0,  0,  0, -1,
+            -1,  0,  0,  0,  0,  0,  0, -1,
+            -1,  0,  0,  0,  0,  0,  0, -1,
+            -1,  0,  0,  0,  0,  0,  0, -1,
+            -1,  0,  0,  0,  0,  0,  0, -1,
+             0,  0,  0,  1,  1,  0,  0,  0,
+        };
+
+        constexpr Table Queen = {
+            -2, -1, -1,  0,  0, -1, -1, -2,
+            -1,  0,  0,  0,  0,  0,  0, -1,
+            -1,  0,  1,  1,  1,  1,  0, -1,
+             0,  0,  1,  1,  1,  1,  0,  0,
+             0,  0,  1,  1,  1,  1,  0,  0,
+            -1,  0,  1,  1,  1,  1,  0, -1,
+            -1,  0,  0,  0,  0,  0,  0, -1,
+            -2, -1, -1,  0,  0, -1, -1, -2,
+        };
+
+        // stay behind the pawns while there are pieces to attack it
+        constexpr Table KingMiddleGame = {
+            -3, -4, -4, -5, -5, -4, -4, -3,
+            -3, -4, -4, -5, -5, -4, -4, -3,
+            -3, -4, -4, -5, -5, -4, -4, -3,
+            -3, -4, -4, -5, -5, -4, -4, -3,
+            -3, -4, -4, -5, -5, -4, -4, -3,
+            -2, -3, -3, -4, -4, -3, -3, -2,
+             2,  2,  0,  0,  0,  0,  2,  2,
+             2,  3,  1,  0,  0,  1,  3,  2,
+        };
+
+        // then come out and help
+        constexpr Table KingEndGame = {
+            -5, -4, -3, -2, -2, -3, -4, -5,
+            -3, -2, -1,  0,  0, -1, -2, -3,
+            -3, -1,  2,  3,  3,  2, -1, -3,
+            -3, -1,  3,  4,  4,  3, -1, -3,
+            -3, -1,  3,  4,  4,  3, -1, -3,
+            -3, -1,  2,  3,  3,  2, -1, -3,
+            -3, -3,  0,  0,  0,  0, -3, -3,
+            -5, -3, -3, -3, -3, -3, -3, -5,
+        };
+
+        constexpr std::array< Table const*, 6 > MiddleGame = { &KingMiddleGame, &Queen, &Bishop, &Knight, &Rook, &PawnMiddleGame };
+        constexpr std::array< Table const*, 6 > EndGame    = { &KingEndGame,    &Queen, &Bishop, &Knight, &Rook, &PawnEndGame };
+    }
+
+    /*
+        Material and square bonuses summed per side, indexed by isAi(). Updated a piece at a time as
+        moves are made and unmade, so evaluating a position never has to look at the board.
+    */
+    struct Accumulator
+    {
+        std::array< int, 2 > middleGame = {};
+        std::array< int, 2 > endGame = {};
+        std::array< int, 2 > phase = {};
+
+        constexpr void add( Piece p, int16_t idx )
+        {
+            update( p, idx, 1 );
+        }
+
+        constexpr void remove( Piece p, int16_t idx )
+        {
+            update( p, idx, -1 );
+        }
+
+        // The full recompute, used to set up a position and to check the incremental updates in debug builds
+        static constexpr Accumulator fromBoard( Piece const* board )
+        {
+            Accumulator a;
+
+            for ( int16_t i = 0; i < 64; ++i )
+            {
+                a.add( board[ i ], i );
+            }
+
+            return a;
+        }
+
+        // The same, visiting only the occupied squares
+        static constexpr Accumulator fromBitboards( bitboard::Boards const& b )
+        {
+            Accumulator a;
+
+            for ( bool const isAi : { false, true } )
+            {
+                for ( auto type = piece::Type::King; type != piece::Type::Null; ++type )
+                {
+                    for ( auto squares = b.of( isAi, type ); squares; )
+                    {
+                        a.add( Piece{ !isAi, type }, bitboard::popFirst( squares ) );
+                    }
+                }
+            }
+
+            return a;
+        }
+
+        constexpr bool operator==( Accumulator const& ) const = default;
+
+    private:
+        constexpr void update( Piece p, int16_t idx, int sign )
+        {
+            if ( p.isNull() )
+                return;
+
+            auto const side = p.isAi();
+            auto const type = static_cast< uint8_t >( p.type );
+            auto const square = side ? idx ^ 56 : idx;
+            auto const value = PieceValues[ type ] + ( side ? 0 : Aggressiveness );
+
+            middleGame[ side ] += sign * ( value + ( *tables::MiddleGame[ type ] )[ square ] );
+            endGame[ side ]    += sign * ( value + ( *tables::EndGame[ type ] )[ square ] );
+            phase[ side ]      += sign * PhaseWeights[ type ];
+        }
+    };
+
+    // Blends the middle and endgame sums by how much material is left, from the point of view of the side to move
+    constexpr int evaluate( Accumulator const& a, bool aiToMove )
+    {
+        auto const phase = std::min( a.phase[ 0 ] + a.phase[ 1 ], MaxPhase );
+
+        auto const middleGame = a.middleGame[ 1 ] - a.middleGame[ 0 ];
+        auto const endGame = a.endGame[ 1 ] - a.endGame[ 0 ];
+
+        auto const score = ( middleGame * phase + endGame * ( MaxPhase - phase ) ) / MaxPhase;
+
+        return aiToMove ? score : -score;
+    }
+}
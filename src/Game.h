@@ -2,13 +2,16 @@
 
 #include <bit>
 #include <array>
-#include <mutex>
-#include <thread>
+#include <algorithm>
+#include <future>
+#include <chrono>
+#include <memory>
+#include <iostream>
+#include <stop_token>
 
 #include "window.h"
 #include "board.h"
 
-#include "Move.h"
 #include "AI.h"
 #include "Highlight.h"
 #include "DangerLevel.h"
@@ -23,23 +26,36 @@ enum class State : uint8_t
     UserMakeMove,
     MainMenu,
     UserWins,
-    AiWins
+    AiWins,
+    Draw
 };
 
 struct AiData
 {
-    std::mutex mutex;
-    std::thread thread;
-    ai::Result result;
+    std::future< ai::SearchResult > pendingMove;
+    std::stop_source stopPendingMove;
+    ai::Move move;
+    // the line the AI expects after its move, which starts with move
+    std::vector< ai::Move > pv;
+    // searching the position after the guessed reply while the player thinks
+    std::unique_ptr< ai::Ponder > ponder;
+    std::future< ai::SearchResult > ponderResult;
+    std::stop_source stopPonder;
+    ai::Move ponderMove;
+    bool ponderHit = false;
+    // of the search that chose move, shown by the statistics overlay
+    stats::Search stats;
+    double userMovedAt = 0;
     float whenToMakeMove;
     Highlight originalPosition = { Highlight::NoPieceSelected, color::Blue };
     Highlight newPosition = { Highlight::NoPieceSelected, color::Green };
     ai::Difficulty difficulty = ai::Difficulty::Hard;
+    ai::Limits limits = ai::getLimits( difficulty );
 };
 
 struct Game
 {
-    std::array< Piece, 64 > board = board::init::DefaultBoard;
+    Position position = Position::startPosition();
     AiData ai;
     Button startGameButton;
     Button quitButton;
@@ -48,6 +64,7 @@ struct Game
     Highlight selectedPiece = { Highlight::NoPieceSelected, color::Blue };
     State state = State::MainMenu;
     danger::Level kingDangerLevel = danger::Level::None;
+    bool showStats = false;
 
     Game()
     {
@@ -78,14 +95,26 @@ struct Game
         endOfGameHeader.box.y -= 150;
     }
 
+    ~Game()
+    {
+        cancelSearches();
+    }
+
     void reset()
     {
+        cancelSearches();
         state = State::MainMenu;
-        board = board::init::DefaultBoard;
+        // built again here as a network may have been loaded since the last game
+        position = Position::startPosition();
         kingDangerLevel = danger::Level::None;
         selectedPiece = { Highlight::NoPieceSelected, color::Blue };
     }
 
+    bool isOver() const
+    {
+        return state == State::UserWins || state == State::AiWins || state == State::Draw;
+    }
+
     bool hasSelectedPiece() const
     {
         return selectedPiece.index != Highlight::NoPieceSelected;
@@ -95,7 +124,7 @@ struct Game
     {
         auto const index = board::coordsToIndex( coords );
 
-        auto const pieceAtIndex = board[ index ];
+        auto const pieceAtIndex = position.board[ index ];
 
         if ( pieceAtIndex.isNull() || pieceAtIndex.isAi() )
         {
@@ -107,7 +136,8 @@ struct Game
         return true;
     }
 
-    bool tryMovePiece( Vec2 coords )
+    // A pawn reaching the last row becomes promotion
+    bool tryMovePiece( Vec2 coords, piece::Type promotion )
     {
         auto const index = board::coordsToIndex( coords );
 
@@ -123,17 +153,31 @@ struct Game
             return false;
         }
 
-        auto const [_, pieceCaptured, __] = board::movePiece( board.data(), selectedPiece.index, index );
+        auto const fromIndex = selectedPiece.index;
+        auto const undo = board::movePiece( position, fromIndex, index, promotion );
         selectedPiece.index = Highlight::NoPieceSelected;
 
-        auto const killedKing = pieceCaptured.isAi() && pieceCaptured.type == piece::Type::King;
+        ai.userMovedAt = GetTime();
 
-        if ( killedKing )
+        auto const ponderHit = ai.ponder
+            && ai.ponderMove == ai::Move{ board::indexToCoords( fromIndex ), coords, undo.promoted ? promotion : piece::Type::Null };
+
+        if ( endIfOver() )
+        {
+            stopPondering();
+        }
+        else if ( ponderHit )
         {
-            state = State::UserWins;
+            // the search already running is on this position, so it only needs its clock started
+            ai.ponder->pondering = false;
+            ai.ponderHit = true;
+            ai.pendingMove = std::move( ai.ponderResult );
+            ai.stopPendingMove = ai.stopPonder;
+            state = State::AiChooseMove;
         }
         else
         {
+            stopPondering();
             startAiMove();
         }
 
@@ -143,29 +187,100 @@ struct Game
     void startAiMove()
     {
         state = State::AiChooseMove;
-        ai.result.ready = false;
-        ai.thread = std::thread([b = board.data(), m = &ai.mutex, r = &ai.result, d = ai.difficulty](){
-            ai::makeMove( b, *m, *r, d );
-        });
+        ai.ponderHit = false;
+        ai.stopPendingMove = {};
+        ai.pendingMove = ai::threadPool().submit( [pos = position, l = ai.limits, stop = ai.stopPendingMove.get_token()]
+        {
+            return ai::makeMove( pos, l, stop );
+        } );
+    }
+
+    // Guesses the player's reply from the second move of the principal variation and starts searching the position after it
+    void startPondering()
+    {
+        if ( !ai::ponder || ai.pv.size() < 2 || !( ai.pv[ 0 ] == ai.move ) )
+            return;
+
+        auto const guess = ai.pv[ 1 ];
+        auto pos = position;
+
+        board::movePiece( pos, board::coordsToIndex( guess.from ), board::coordsToIndex( guess.dst ), guess.promotion );
+
+        MoveList replies;
+        ai::details::generateMoves( pos, replies );
+
+        // the game would be over
+        if ( replies.empty() )
+            return;
+
+        ai.ponderMove = guess;
+        ai.ponder = std::make_unique< ai::Ponder >();
+        ai.stopPonder = {};
+        ai.ponderResult = ai::threadPool().submit( [pos, l = ai.limits, stop = ai.stopPonder.get_token(), p = ai.ponder.get()]
+        {
+            return ai::makeMove( pos, l, stop, p );
+        } );
+    }
+
+    // Abandons a ponder search that guessed wrong; its transposition table entries are kept
+    void stopPondering()
+    {
+        cancelSearch( ai.stopPonder, ai.ponderResult );
+        ai.ponder.reset();
+    }
+
+    // Stops anything still searching for a game that is over or being closed
+    void cancelSearches()
+    {
+        // a ponder hit moved its search into pendingMove, which still needs ai.ponder
+        cancelSearch( ai.stopPendingMove, ai.pendingMove );
+        stopPondering();
+    }
+
+    // Asks a search to stop and waits for it, reporting how long that took
+    static void cancelSearch( std::stop_source& stop, std::future< ai::SearchResult >& result )
+    {
+        if ( !result.valid() )
+            return;
+
+        if ( result.wait_for( std::chrono::seconds( 0 ) ) != std::future_status::ready )
+        {
+            // not the window's clock, as this also runs once the window is closed
+            auto const before = std::chrono::steady_clock::now();
+
+            stop.request_stop();
+            result.wait();
+
+            auto const latency = std::chrono::duration< double, std::milli >( std::chrono::steady_clock::now() - before ).count();
+
+            std::cout << "Cancelled a search in " << latency << "ms" << std::endl;
+        }
+
+        result = {};
     }
 
     void update( float frameTime )
     {
         if ( state == State::AiChooseMove )
         {
-            auto const lock = std::scoped_lock( ai.mutex );
-
-            if ( ai.result.ready )
+            if ( ai.pendingMove.wait_for( std::chrono::seconds( 0 ) ) == std::future_status::ready )
             {
                 state = State::AiMakeMove;
 
                 ai.whenToMakeMove = 1.5;
 
-                ai.originalPosition.index = board::coordsToIndex( ai.result.move.from );
-                ai.newPosition.index = board::coordsToIndex( ai.result.move.dst );
+                auto const result = ai.pendingMove.get();
 
-                if ( ai.thread.joinable() )
-                    ai.thread.join();
+                ai.move = result.move;
+                ai.pv = result.pv;
+                ai.stats = result.stats;
+                ai.ponder.reset();
+
+                std::cout << "Replied " << GetTime() - ai.userMovedAt << "s after the player's move"
+                          << ( ai.ponderHit ? " (ponder hit)" : "" ) << std::endl;
+
+                ai.originalPosition.index = board::coordsToIndex( ai.move.from );
+                ai.newPosition.index = board::coordsToIndex( ai.move.dst );
             }
         }
         else if ( state == State::AiMakeMove )
@@ -173,17 +288,14 @@ struct Game
             ai.whenToMakeMove -= frameTime;
             if ( ai.whenToMakeMove <= 0 )
             {
-                auto const [_, pieceCaptured, __] = board::movePiece( board.data(), ai.result.move.from, ai.result.move.dst );
-                ai.result.ready = false;
+                board::movePiece( position, board::coordsToIndex( ai.move.from ), board::coordsToIndex( ai.move.dst ), ai.move.promotion );
                 ai.originalPosition.index = Highlight::NoPieceSelected;
                 ai.newPosition.index = Highlight::NoPieceSelected;
                 state = State::UserMakeMove;
 
-                auto const killedKing = pieceCaptured.isUser() && pieceCaptured.type == piece::Type::King;
-
-                if ( killedKing )
+                if ( !endIfOver() )
                 {
-                    state = State::AiWins;
+                    startPondering();
                 }
             }
         }
@@ -206,7 +318,7 @@ struct Game
             {
                 auto const coords = Vec2{ i, j };
                 auto const index = board::coordsToIndex( coords );
-                auto const piece = board[ index ];
+                auto const piece = position.board[ index ];
 
                 renderCheckerBoardAt( coords, index, piece );
 
@@ -215,20 +327,51 @@ struct Game
             }
         }
 
-        if ( state == State::UserWins || state == State::AiWins )
-        {
-            auto const userWins = state == State::UserWins;
+        if ( showStats )
+            renderStats();
 
+        if ( isOver() )
+        {
             auto color = WHITE;
             color.a = 156;
             DrawRectangle( 0, 0, window::Width, window::Height, color );
 
             playAgainButton.render();
             quitButton.render();
-            endOfGameHeader.render( userWins ? "You win!" : "Ai wins!" );
+            endOfGameHeader.render( state == State::UserWins ? "You win!" : state == State::AiWins ? "Ai wins!" : "Draw!" );
         }
     }
 private:
+    // The last search's statistics over the top left of the board, toggled with S
+    void renderStats() const
+    {
+        constexpr int TextSize = 16;
+        constexpr int LineHeight = TextSize + 4;
+        constexpr int Lines = 6;
+
+        auto const& s = ai.stats;
+
+        auto color = BLACK;
+        color.a = 180;
+        DrawRectangle( 0, 0, 360, LineHeight * Lines + 8, color );
+
+        int line = 0;
+
+        // TextFormat reuses a handful of buffers, so each line is drawn as soon as it's formatted
+        auto const drawLine = [&line]( const char* text )
+        {
+            Vector2 const pos = { 6, static_cast< float >( 4 + LineHeight * line++ ) };
+            DrawTextEx( GetFontDefault(), text, pos, TextSize, 2, WHITE );
+        };
+
+        drawLine( TextFormat( "depth %d, %.2fs", s.depth, s.seconds ) );
+        drawLine( TextFormat( "%llu nodes, %llu in quiescence", static_cast< unsigned long long >( s.nodes() ), static_cast< unsigned long long >( s.quiescenceNodes() ) ) );
+        drawLine( TextFormat( "%.0f nodes/s", s.nodesPerSecond() ) );
+        drawLine( TextFormat( "branching factor %.2f", s.effectiveBranchingFactor() ) );
+        drawLine( TextFormat( "beta cutoffs %.1f%%, first move %.1f%%", 100.0 * s.betaCutoffRate(), 100.0 * s.firstMoveCutoffRate() ) );
+        drawLine( TextFormat( "hash hits %.1f%% of %llu probes", 100.0 * s.ttHitRate(), static_cast< unsigned long long >( s.ttProbes ) ) );
+    }
+
     void renderCheckerBoardAt( Vec2 coords, int16_t index, Piece piece ) const
     {
         auto const isBlack = (coords.j & 1) ? !(coords.i & 1) : !!(coords.i & 1);
@@ -280,110 +423,41 @@ private:
         DrawTexturePro( t, imgCrop, imgPos, {0, 0}, 0, WHITE );
     }
 
-    bool isValidMove( Vec2 from, Vec2 dst )
+    // One of the user's legal moves, which never leaves their king in check
+    bool isValidMove( Vec2 from, Vec2 dst ) const
     {
         auto const fromIdx = board::coordsToIndex( from );
         auto const dstIdx = board::coordsToIndex( dst );
-        auto const pieceToBeMoved = board[ fromIdx ];
-        auto const pieceToBeCaptured = board[ dstIdx ];
-
-        // can't take your own piece
-        if ( pieceToBeCaptured.isUser() )
-        {
-            return false;
-        }
-
-        // handle pawn separately
-        if ( pieceToBeMoved.type == piece::Type::Pawn )
-        {
-            auto const dstIsEmpty = pieceToBeCaptured.type == piece::Type::Null;
-
-            auto const isMovingUpTwo = from + move::Up * 2 == dst;
-
-            if ( dstIsEmpty && board::isPawnStartingPosition( fromIdx ) && isMovingUpTwo )
-            {
-                return true;
-            }
-
-            auto const isMovingUpOne = from + move::Up == dst;
-
-            if ( dstIsEmpty && isMovingUpOne )
-                return true;
-
-            auto const isAttackingDiagonally =
-                pieceToBeCaptured.isAi()
-                && ( from + move::UpAndLeft == dst || from + move::UpAndRight == dst );
-            
-            if ( isAttackingDiagonally )
-                return true;
-
-            return false;
-        }
-
-        bool foundDst = false;
-        bool isValidDst = false;
 
-        auto it = move::Iterator( pieceToBeMoved.type );
+        MoveList moves;
+        ai::details::generateMoves( position, moves );
 
-        while ( it.hasNext() && !foundDst )
-        {
-            auto const possibleDst = from + it.next();
-
-            if ( board::isOutOfBounds( possibleDst ) )
-            {
-                it.skipToNextDirection();
-                continue;
-            }
-
-            auto const possiblePiece = board[ board::coordsToIndex( possibleDst ) ];
-
-            if ( possibleDst == dst )
-            {
-                foundDst = true;
-                isValidDst = !possiblePiece.isUser();
-                break;
-            }
+        return std::any_of( moves.begin(), moves.end(), [fromIdx, dstIdx]( OrderedMove const& m ) { return m.move.is( fromIdx, dstIdx ); } );
+    }
 
-            // stop searching direction if we run into a piece
-            if ( !possiblePiece.isNull() )
-            {
-                it.skipToNextDirection();
-                continue;
-            }
-        }
+    // Ends the game once the side to move has no legal move: checkmate, or stalemate, which is a draw
+    bool endIfOver()
+    {
+        MoveList moves;
+        ai::details::generateMoves( position, moves );
 
-        if ( !foundDst )
+        if ( !moves.empty() )
             return false;
 
-        if ( pieceToBeMoved.type == piece::Type::King )
-        {
-            // make move
-            auto const [b4from, b4dst, _] = board::movePiece( board.data(), fromIdx, dstIdx );
-
-            auto const dangerLevel = getKingDangerLevel();
-
-            // undo move
-            board[ fromIdx ] = b4from;
-            board[ dstIdx ]  = b4dst;
-
-            if ( dangerLevel != danger::Level::None )
-                return false;            
-        }
+        if ( !position.isInCheck( position.aiToMove ) )
+            state = State::Draw;
+        else
+            state = position.aiToMove ? State::UserWins : State::AiWins;
 
-        return isValidDst;
+        return true;
     }
 
+    // Called every frame, so the king is looked up rather than searched for and its attackers read from the attack map
     danger::Level getKingDangerLevel()
     {
-        for ( int16_t i = 0; i < 64; ++i )
-        {
-            auto const piece = board[ i ];
-            if ( piece.isNull() || piece.isAi() || piece.type != piece::Type::King )
-                continue;
-
-            return danger::getDangerLevel( board.data(), piece, board::indexToCoords( i ) );
-        }
+        if ( !position.hasKing( false ) )
+            return danger::Level::None;
 
-        return danger::Level::None;
+        return danger::getDangerLevel( position, position.kings[ false ] );
     }
 };
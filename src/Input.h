@@ -4,6 +4,9 @@
 
 void processInput( Game& game )
 {
+    if ( IsKeyPressed( KEY_S ) )
+        game.showStats = !game.showStats;
+
     if ( game.state == State::AiChooseMove || game.state == State::AiMakeMove )
         return;
     
@@ -20,7 +23,13 @@ void processInput( Game& game )
     {
         if ( game.hasSelectedPiece() )
         {
-            game.tryMovePiece( coords );
+            // a pawn reaching the last row becomes a queen, or a knight, bishop or rook with N, B or R held
+            auto const promotion = IsKeyDown( KEY_N ) ? piece::Type::Knight
+                                 : IsKeyDown( KEY_B ) ? piece::Type::Bishop
+                                 : IsKeyDown( KEY_R ) ? piece::Type::Rook
+                                 : piece::Type::Queen;
+
+            game.tryMovePiece( coords, promotion );
         }
         else if ( !game.trySelectPiece( coords ) )
         {
@@ -31,6 +40,7 @@ void processInput( Game& game )
     {
         if ( CheckCollisionPointRec( mousePos, game.startGameButton.box ) )
         {
+            game.reset();
             game.state = State::UserMakeMove;
         }
         else if ( CheckCollisionPointRec( mousePos, game.quitButton.box ) )
@@ -38,7 +48,7 @@ void processInput( Game& game )
             game.state = State::Quit;
         }
     }
-    else if ( game.state == State::AiWins || game.state == State::UserWins )
+    else if ( game.isOver() )
     {
         if ( CheckCollisionPointRec( mousePos, game.playAgainButton.box ) )
         {
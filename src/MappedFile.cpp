@@ -0,0 +1,145 @@
+#include "MappedFile.h"
+
+#include <utility>
+
+#if defined( _WIN32 )
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile( MappedFile&& other ) noexcept
+{
+    *this = std::move( other );
+}
+
+MappedFile& MappedFile::operator=( MappedFile&& other ) noexcept
+{
+    if ( this != &other )
+    {
+        close();
+
+        m_data = std::exchange( other.m_data, nullptr );
+        m_size = std::exchange( other.m_size, 0 );
+#if defined( _WIN32 )
+        m_file = std::exchange( other.m_file, nullptr );
+        m_mapping = std::exchange( other.m_mapping, nullptr );
+#endif
+    }
+
+    return *this;
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+#if defined( _WIN32 )
+
+bool MappedFile::open( std::filesystem::path const& path )
+{
+    close();
+
+    auto const file = CreateFileW( path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+
+    if ( file == INVALID_HANDLE_VALUE )
+        return false;
+
+    LARGE_INTEGER size;
+
+    if ( !GetFileSizeEx( file, &size ) || size.QuadPart == 0 )
+    {
+        CloseHandle( file );
+        return false;
+    }
+
+    auto const mapping = CreateFileMappingW( file, nullptr, PAGE_READONLY, 0, 0, nullptr );
+
+    if ( !mapping )
+    {
+        CloseHandle( file );
+        return false;
+    }
+
+    auto const view = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+
+    if ( !view )
+    {
+        CloseHandle( mapping );
+        CloseHandle( file );
+        return false;
+    }
+
+    m_file = file;
+    m_mapping = mapping;
+    m_data = static_cast< std::byte const* >( view );
+    m_size = static_cast< size_t >( size.QuadPart );
+
+    return true;
+}
+
+void MappedFile::close()
+{
+    if ( m_data )
+        UnmapViewOfFile( m_data );
+
+    if ( m_mapping )
+        CloseHandle( m_mapping );
+
+    if ( m_file )
+        CloseHandle( m_file );
+
+    m_data = nullptr;
+    m_size = 0;
+    m_file = nullptr;
+    m_mapping = nullptr;
+}
+
+#else
+
+bool MappedFile::open( std::filesystem::path const& path )
+{
+    close();
+
+    auto const fd = ::open( path.c_str(), O_RDONLY );
+
+    if ( fd < 0 )
+        return false;
+
+    struct stat info;
+
+    if ( fstat( fd, &info ) != 0 || info.st_size == 0 )
+    {
+        ::close( fd );
+        return false;
+    }
+
+    auto const view = mmap( nullptr, static_cast< size_t >( info.st_size ), PROT_READ, MAP_SHARED, fd, 0 );
+
+    // the mapping keeps the file alive on its own
+    ::close( fd );
+
+    if ( view == MAP_FAILED )
+        return false;
+
+    m_data = static_cast< std::byte const* >( view );
+    m_size = static_cast< size_t >( info.st_size );
+
+    return true;
+}
+
+void MappedFile::close()
+{
+    if ( m_data )
+        munmap( const_cast< std::byte* >( m_data ), m_size );
+
+    m_data = nullptr;
+    m_size = 0;
+}
+
+#endif
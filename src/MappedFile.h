@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <span>
+
+/*
+    A read only view of a whole file, mapped into memory so large tables cost nothing to open and
+    pages are only read when they are touched. The operating system calls live in MappedFile.cpp,
+    away from raylib, whose names clash with windows.h.
+*/
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    MappedFile( MappedFile&& other ) noexcept;
+    MappedFile& operator=( MappedFile&& other ) noexcept;
+    ~MappedFile();
+
+    MappedFile( MappedFile const& ) = delete;
+    MappedFile& operator=( MappedFile const& ) = delete;
+
+    // False if the file can't be opened or is empty
+    bool open( std::filesystem::path const& path );
+    void close();
+
+    std::span< std::byte const > data() const { return { m_data, m_size }; }
+    bool isOpen() const { return m_data != nullptr; }
+
+private:
+    std::byte const* m_data = nullptr;
+    size_t m_size = 0;
+#if defined( _WIN32 )
+    void* m_file = nullptr;
+    void* m_mapping = nullptr;
+#endif
+};
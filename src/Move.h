@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <vector>
 
 #include "Piece.h"
@@ -24,7 +25,7 @@ namespace move
     constexpr Vec2 DownAndRight = Down + Right;
 
 
-    constexpr std::array KingMoves = {
+    inline constexpr std::array KingMoves = {
         Move{ move::Up, 1 },
         Move{ move::Down, 1 },
         Move{ move::Left, 1 },
@@ -35,7 +36,7 @@ namespace move
         Move{ move::DownAndRight, 1 }
     };
 
-    constexpr std::array QueenMoves = {
+    inline constexpr std::array QueenMoves = {
         Move{ move::Up, 7 },
         Move{ move::Down, 7 },
         Move{ move::Left, 7 },
@@ -46,14 +47,14 @@ namespace move
         Move{ move::DownAndRight, 7 }
     };
 
-    constexpr std::array BishopMoves = {
+    inline constexpr std::array BishopMoves = {
         Move{ move::UpAndLeft, 7 },
         Move{ move::UpAndRight, 7 },
         Move{ move::DownAndLeft, 7 },
         Move{ move::DownAndRight, 7 }
     };
 
-    constexpr std::array KnightMoves = {
+    inline constexpr std::array KnightMoves = {
         Move{ move::Up * 2    + move::Left, 1 },
         Move{ move::Up * 2    + move::Right, 1 },
         Move{ move::Down * 2  + move::Left, 1 },
@@ -64,7 +65,7 @@ namespace move
         Move{ move::Right * 2 + move::Down, 1 },
     };
 
-    constexpr std::array RookMoves = {
+    inline constexpr std::array RookMoves = {
         Move{ move::Up, 7 },
         Move{ move::Down, 7 },
         Move{ move::Left, 7 },
@@ -75,29 +76,29 @@ namespace move
 
     constexpr Vec2 BlackPawnDirection = move::Up;
 
-    constexpr std::array WhitePawnAttacks = {
+    inline constexpr std::array WhitePawnAttacks = {
         Move{ WhitePawnDirection + move::Left, 1 },
         Move{ WhitePawnDirection + move::Right, 1 }
     };
 
-    constexpr std::array BlackPawnAttacks = {
+    inline constexpr std::array BlackPawnAttacks = {
         Move{ BlackPawnDirection + move::Left, 1 },
         Move{ BlackPawnDirection + move::Right, 1 }
     };
 
-    constexpr std::array WhitePawnMoves = {
+    inline constexpr std::array WhitePawnMoves = {
         Move{ WhitePawnDirection, 1 }
     };
 
-    constexpr std::array BlackPawnMoves = {
+    inline constexpr std::array BlackPawnMoves = {
         Move{ BlackPawnDirection, 1 }
     };
 
-    constexpr std::array WhitePawnStartingMoves = {
+    inline constexpr std::array WhitePawnStartingMoves = {
         Move{ WhitePawnDirection, 2 }
     };
 
-    constexpr std::array BlackPawnStartingMoves = {
+    inline constexpr std::array BlackPawnStartingMoves = {
         Move{ BlackPawnDirection, 2 }
     };
 
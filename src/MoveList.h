@@ -0,0 +1,100 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+#include "Piece.h"
+
+/*
+    A move in 16 bits: 6 for the square it's from, 6 for its destination, one saying it captures and
+    three for the piece a pawn promotes to. Default construction leaves it uninitialised so move lists
+    cost nothing to create; PackedMove{} is the null move.
+*/
+class PackedMove
+{
+public:
+    PackedMove() = default;
+
+    constexpr PackedMove( int16_t from, int16_t dst, bool isCapture = false, piece::Type promotion = piece::Type::Null ):
+        m_data( static_cast< uint16_t >( ( from & 63 )
+                                       | ( dst & 63 ) << 6
+                                       | isCapture << 12
+                                       | ( promotion == piece::Type::Null ? 0 : promotion ) << 13 ) ) {}
+
+    constexpr int16_t from() const { return m_data & 63; }
+    constexpr int16_t dst() const { return ( m_data >> 6 ) & 63; }
+    constexpr bool isCapture() const { return m_data & ( 1 << 12 ); }
+
+    // Null if the move isn't a promotion. A pawn never promotes to a king, so 0 is free to mean none
+    constexpr piece::Type promotion() const
+    {
+        auto const type = m_data >> 13;
+        return type == 0 ? piece::Type::Null : static_cast< piece::Type >( type );
+    }
+
+    constexpr bool isPromotion() const { return m_data >> 13; }
+
+    // A real move never ends where it started
+    constexpr bool isNull() const { return m_data == 0; }
+
+    constexpr bool is( int16_t from, int16_t dst ) const { return ( m_data & 0xfff ) == ( ( from & 63 ) | ( dst & 63 ) << 6 ); }
+
+    constexpr uint16_t raw() const { return m_data; }
+    static constexpr PackedMove fromRaw( uint16_t raw ) { PackedMove m; m.m_data = raw; return m; }
+
+    constexpr bool operator==( PackedMove const& ) const = default;
+
+private:
+    uint16_t m_data;
+};
+
+static_assert( sizeof( PackedMove ) == 2 );
+
+// A move and how early it should be searched; higher is sooner
+struct OrderedMove
+{
+    PackedMove move;
+    int order;
+};
+
+/*
+    The moves of one position, kept on the stack. Move generation appends to it, so a node never
+    allocates. No reachable position has anywhere near Capacity moves.
+*/
+class MoveList
+{
+public:
+    static constexpr size_t Capacity = 256;
+
+    void push_back( OrderedMove m )
+    {
+        assert( m_size < Capacity );
+        m_moves[ m_size++ ] = m;
+    }
+
+    // Only ever shrinks the list
+    void resize( size_t size )
+    {
+        assert( size <= m_size );
+        m_size = size;
+    }
+
+    void clear() { m_size = 0; }
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    OrderedMove& operator[]( size_t i ) { return m_moves[ i ]; }
+    OrderedMove const& operator[]( size_t i ) const { return m_moves[ i ]; }
+
+    OrderedMove* begin() { return m_moves.data(); }
+    OrderedMove* end() { return m_moves.data() + m_size; }
+    OrderedMove const* begin() const { return m_moves.data(); }
+    OrderedMove const* end() const { return m_moves.data() + m_size; }
+
+private:
+    std::array< OrderedMove, Capacity > m_moves;
+    size_t m_size = 0;
+};
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+
+#include "MoveList.h"
+
+namespace ordering
+{
+    constexpr int MaxPly = 128;
+
+    // history scores stay within +-MaxHistory, below the order of killers and captures
+    constexpr int MaxHistory = 1 << 14;
+
+    constexpr int CounterMoveOrder = 1 << 24;
+    constexpr int KillerOrder      = 1 << 25;
+
+    // where the move that caused a beta cutoff was placed by the ordering
+    enum class Source : uint8_t
+    {
+        Hash,
+        Capture,
+        Killer,
+        CounterMove,
+        History,
+        Count
+    };
+
+    inline constexpr std::array SourceNames = {
+        "hash",
+        "capture",
+        "killer",
+        "counter",
+        "history"
+    };
+
+    struct Stats
+    {
+        uint64_t betaCutoffs = 0;
+        uint64_t firstMoveCutoffs = 0;
+        std::array< uint64_t, static_cast< size_t >( Source::Count ) > cutoffsBySource{};
+        // moves produced by the move generator, and the nodes that asked for any
+        uint64_t movesGenerated = 0;
+        uint64_t nodesGeneratingMoves = 0;
+
+        void onCutoff( Source source, bool firstMove )
+        {
+            betaCutoffs += 1;
+            firstMoveCutoffs += firstMove;
+            cutoffsBySource[ static_cast< size_t >( source ) ] += 1;
+        }
+
+        double firstMoveCutoffRate() const
+        {
+            return betaCutoffs == 0 ? 0.0 : static_cast< double >( firstMoveCutoffs ) / betaCutoffs;
+        }
+
+        double movesGeneratedPerNode() const
+        {
+            return nodesGeneratingMoves == 0 ? 0.0 : static_cast< double >( movesGenerated ) / nodesGeneratingMoves;
+        }
+
+        Stats& operator+=( Stats const& other )
+        {
+            betaCutoffs += other.betaCutoffs;
+            firstMoveCutoffs += other.firstMoveCutoffs;
+            movesGenerated += other.movesGenerated;
+            nodesGeneratingMoves += other.nodesGeneratingMoves;
+
+            for ( size_t i = 0; i < cutoffsBySource.size(); ++i )
+            {
+                cutoffsBySource[ i ] += other.cutoffsBySource[ i ];
+            }
+
+            return *this;
+        }
+    };
+
+    /*
+        Quiet move ordering learned during a search: two killer moves per ply, a butterfly history
+        table per side, and the move that last refuted each previous move.
+    */
+    class Heuristics
+    {
+    public:
+        // Order for a quiet move: killers, then the counter move, then history
+        int quietOrder( int ply, bool isAi, PackedMove move, PackedMove previous ) const
+        {
+            if ( m_killers[ ply ][ 0 ] == move )
+                return KillerOrder;
+
+            if ( m_killers[ ply ][ 1 ] == move )
+                return KillerOrder - 1;
+
+            if ( isCounterMove( previous, move ) )
+                return CounterMoveOrder;
+
+            // offset so quiet moves with negative history still have a positive order
+            return MaxHistory + m_history[ isAi ][ move.from() ][ move.dst() ];
+        }
+
+        PackedMove killer( int ply, int slot ) const
+        {
+            return m_killers[ ply ][ slot ];
+        }
+
+        PackedMove counterMove( PackedMove previous ) const
+        {
+            return previous.isNull() ? PackedMove{} : m_counterMoves[ previous.from() ][ previous.dst() ];
+        }
+
+        bool isKiller( int ply, PackedMove move ) const
+        {
+            return m_killers[ ply ][ 0 ] == move || m_killers[ ply ][ 1 ] == move;
+        }
+
+        bool isCounterMove( PackedMove previous, PackedMove move ) const
+        {
+            return !previous.isNull() && m_counterMoves[ previous.from() ][ previous.dst() ] == move;
+        }
+
+        // A quiet move caused a beta cutoff; the quiet moves searched before it didn't
+        template< class QuietMoves >
+        void onQuietCutoff( int ply, bool isAi, int depth, PackedMove move, PackedMove previous, QuietMoves const& triedBefore )
+        {
+            if ( m_killers[ ply ][ 0 ] != move )
+            {
+                m_killers[ ply ][ 1 ] = m_killers[ ply ][ 0 ];
+                m_killers[ ply ][ 0 ] = move;
+            }
+
+            if ( !previous.isNull() )
+                m_counterMoves[ previous.from() ][ previous.dst() ] = move;
+
+            auto const bonus = std::min( depth * depth + depth + 1, 400 );
+
+            updateHistory( isAi, move, bonus );
+
+            for ( auto const& tried : triedBefore )
+            {
+                updateHistory( isAi, tried, -bonus );
+            }
+        }
+
+    private:
+        // moves the entry towards +-MaxHistory by an amount that shrinks as it gets closer
+        void updateHistory( bool isAi, PackedMove move, int bonus )
+        {
+            auto& entry = m_history[ isAi ][ move.from() ][ move.dst() ];
+
+            entry += bonus - entry * std::abs( bonus ) / MaxHistory;
+        }
+
+    private:
+        std::array< std::array< PackedMove, 2 >, MaxPly > m_killers{};
+        std::array< std::array< std::array< int, 64 >, 64 >, 2 > m_history{};
+        std::array< std::array< PackedMove, 64 >, 64 > m_counterMoves{};
+    };
+}
@@ -0,0 +1,99 @@
+#include "Nnue.h"
+
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+
+namespace nnue
+{
+    namespace
+    {
+        constexpr char Magic[] = "CHESSNN1";
+
+        // Network files are little endian, which is every machine this builds for
+        static_assert( std::endian::native == std::endian::little );
+
+        template< class T >
+        bool read( std::istream& in, T* data, size_t count )
+        {
+            in.read( reinterpret_cast< char* >( data ), static_cast< std::streamsize >( count * sizeof( T ) ) );
+            return static_cast< bool >( in );
+        }
+
+        template< class T >
+        void fill( std::mt19937& rng, T* data, size_t count, int min, int max )
+        {
+            std::uniform_int_distribution< int > dist( min, max );
+
+            for ( size_t i = 0; i < count; ++i )
+            {
+                data[ i ] = static_cast< T >( dist( rng ) );
+            }
+        }
+    }
+
+    std::unique_ptr< Network > Network::load( const char* path )
+    {
+        std::ifstream in( path, std::ios::binary );
+
+        if ( !in )
+        {
+            std::cerr << "Can't open network file " << path << "\n";
+            return nullptr;
+        }
+
+        char magic[ sizeof( Magic ) - 1 ];
+        uint32_t sizes[ 3 ];
+
+        if ( !read( in, magic, sizeof( magic ) ) || std::memcmp( magic, Magic, sizeof( magic ) ) != 0 )
+        {
+            std::cerr << path << " isn't a network file\n";
+            return nullptr;
+        }
+
+        if ( !read( in, sizes, 3 ) || sizes[ 0 ] != HalfDimensions || sizes[ 1 ] != Hidden1 || sizes[ 2 ] != Hidden2 )
+        {
+            std::cerr << path << " has layers of a different size, expected " << HalfDimensions << "x2-" << Hidden1 << "-" << Hidden2 << "-1\n";
+            return nullptr;
+        }
+
+        auto net = std::make_unique< Network >();
+
+        auto const ok = read( in, net->featureBiases.data(), net->featureBiases.size() )
+                     && read( in, net->featureWeights.data(), net->featureWeights.size() )
+                     && read( in, net->hidden1Biases.data(), net->hidden1Biases.size() )
+                     && read( in, net->hidden1Weights.data(), net->hidden1Weights.size() )
+                     && read( in, net->hidden2Biases.data(), net->hidden2Biases.size() )
+                     && read( in, net->hidden2Weights.data(), net->hidden2Weights.size() )
+                     && read( in, &net->outputBias, 1 )
+                     && read( in, net->outputWeights.data(), net->outputWeights.size() );
+
+        if ( !ok || in.peek() != std::ifstream::traits_type::eof() )
+        {
+            std::cerr << path << " is the wrong size for its network\n";
+            return nullptr;
+        }
+
+        return net;
+    }
+
+    std::unique_ptr< Network > Network::random( uint32_t seed )
+    {
+        std::mt19937 rng( seed );
+
+        auto net = std::make_unique< Network >();
+
+        // a position has about 30 inputs, which keeps most of the accumulator inside the clipping range
+        fill( rng, net->featureBiases.data(), net->featureBiases.size(), 0, 64 );
+        fill( rng, net->featureWeights.data(), net->featureWeights.size(), -8, 8 );
+        fill( rng, net->hidden1Biases.data(), net->hidden1Biases.size(), -1024, 1024 );
+        fill( rng, net->hidden1Weights.data(), net->hidden1Weights.size(), -16, 16 );
+        fill( rng, net->hidden2Biases.data(), net->hidden2Biases.size(), -1024, 1024 );
+        fill( rng, net->hidden2Weights.data(), net->hidden2Weights.size(), -32, 32 );
+        fill( rng, net->outputWeights.data(), net->outputWeights.size(), -64, 64 );
+
+        return net;
+    }
+}
@@ -0,0 +1,484 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#if defined( __AVX2__ ) || defined( __SSSE3__ ) || defined( __SSE2__ )
+#include <immintrin.h>
+#endif
+
+#include "Piece.h"
+
+/*
+    An efficiently updatable neural network evaluation, HalfKP style. Each side sees the board from
+    its own king: the inputs are every (king square, piece, square) triple, with the board mirrored
+    for the ai so both sides look up the board. Only a handful of inputs change per move, so the
+    first layer's output (the accumulator) is updated a column at a time as moves are made and
+    unmade. The small layers after it are recomputed for every evaluation in 8-bit integers.
+*/
+namespace nnue
+{
+    constexpr int PieceFeatures = 5 * 2 * 64; // queen to pawn, ours or theirs, on each square
+    constexpr int InputDimensions = 64 * PieceFeatures;
+    constexpr int HalfDimensions = 128;
+    constexpr int Hidden1 = 32;
+    constexpr int Hidden2 = 32;
+
+    // Hidden layer sums are shifted down by this before clipping to 0..127
+    constexpr int WeightShift = 6;
+    // The output divided by this is in the units of evaluation::evaluate
+    constexpr int OutputScale = 64;
+
+    constexpr int16_t NoKing = -1;
+
+#if defined( __AVX2__ )
+    constexpr const char* Instructions = "avx2";
+#elif defined( __SSSE3__ )
+    constexpr const char* Instructions = "ssse3";
+#elif defined( __SSE2__ )
+    constexpr const char* Instructions = "sse2";
+#else
+    constexpr const char* Instructions = "scalar";
+#endif
+
+    /*
+        The weights, in the order they are stored in a network file after an 8 byte "CHESSNN1" magic
+        and the three layer sizes as little endian uint32s. Every array is little endian and row major,
+        one row per output.
+    */
+    struct Network
+    {
+        std::vector< int16_t > featureBiases = std::vector< int16_t >( HalfDimensions );
+        std::vector< int16_t > featureWeights = std::vector< int16_t >( InputDimensions * HalfDimensions );
+        std::array< int32_t, Hidden1 > hidden1Biases{};
+        std::array< int8_t, Hidden1 * HalfDimensions * 2 > hidden1Weights{};
+        std::array< int32_t, Hidden2 > hidden2Biases{};
+        std::array< int8_t, Hidden2 * Hidden1 > hidden2Weights{};
+        int32_t outputBias = 0;
+        std::array< int8_t, Hidden2 > outputWeights{};
+
+        // Null, having said why, if the file can't be read or is for a different architecture
+        static std::unique_ptr< Network > load( const char* path );
+
+        // Small random weights; only good for measuring speed
+        static std::unique_ptr< Network > random( uint32_t seed );
+    };
+
+    // The network in use. While it's null the search uses the hand written evaluation and positions skip the accumulator
+    inline std::unique_ptr< Network > network;
+
+    /*
+        Integer kernels, with a scalar version of each that is always compiled. Sizes have to be
+        multiples of 32.
+    */
+    namespace simd
+    {
+        template< bool Vectorised = true >
+        inline void addColumn( int16_t* acc, int16_t const* column )
+        {
+#if defined( __AVX2__ )
+            if constexpr ( Vectorised )
+            {
+                for ( int i = 0; i < HalfDimensions; i += 16 )
+                {
+                    auto const a = _mm256_loadu_si256( reinterpret_cast< __m256i const* >( acc + i ) );
+                    auto const c = _mm256_loadu_si256( reinterpret_cast< __m256i const* >( column + i ) );
+                    _mm256_storeu_si256( reinterpret_cast< __m256i* >( acc + i ), _mm256_add_epi16( a, c ) );
+                }
+                return;
+            }
+#elif defined( __SSE2__ )
+            if constexpr ( Vectorised )
+            {
+                for ( int i = 0; i < HalfDimensions; i += 8 )
+                {
+                    auto const a = _mm_loadu_si128( reinterpret_cast< __m128i const* >( acc + i ) );
+                    auto const c = _mm_loadu_si128( reinterpret_cast< __m128i const* >( column + i ) );
+                    _mm_storeu_si128( reinterpret_cast< __m128i* >( acc + i ), _mm_add_epi16( a, c ) );
+                }
+                return;
+            }
+#endif
+            for ( int i = 0; i < HalfDimensions; ++i )
+            {
+                acc[ i ] += column[ i ];
+            }
+        }
+
+        template< bool Vectorised = true >
+        inline void subColumn( int16_t* acc, int16_t const* column )
+        {
+#if defined( __AVX2__ )
+            if constexpr ( Vectorised )
+            {
+                for ( int i = 0; i < HalfDimensions; i += 16 )
+                {
+                    auto const a = _mm256_loadu_si256( reinterpret_cast< __m256i const* >( acc + i ) );
+                    auto const c = _mm256_loadu_si256( reinterpret_cast< __m256i const* >( column + i ) );
+                    _mm256_storeu_si256( reinterpret_cast< __m256i* >( acc + i ), _mm256_sub_epi16( a, c ) );
+                }
+                return;
+            }
+#elif defined( __SSE2__ )
+            if constexpr ( Vectorised )
+            {
+                for ( int i = 0; i < HalfDimensions; i += 8 )
+                {
+                    auto const a = _mm_loadu_si128( reinterpret_cast< __m128i const* >( acc + i ) );
+                    auto const c = _mm_loadu_si128( reinterpret_cast< __m128i const* >( column + i ) );
+                    _mm_storeu_si128( reinterpret_cast< __m128i* >( acc + i ), _mm_sub_epi16( a, c ) );
+                }
+                return;
+            }
+#endif
+            for ( int i = 0; i < HalfDimensions; ++i )
+            {
+                acc[ i ] -= column[ i ];
+            }
+        }
+
+        // Clamps the accumulator to 0..127 so the next layer can multiply in 8 bits
+        template< bool Vectorised = true >
+        inline void clippedRelu( int16_t const* in, uint8_t* out, int size )
+        {
+#if defined( __AVX2__ )
+            if constexpr ( Vectorised )
+            {
+                auto const max = _mm256_set1_epi8( 127 );
+
+                for ( int i = 0; i < size; i += 32 )
+                {
+                    auto const a = _mm256_loadu_si256( reinterpret_cast< __m256i const* >( in + i ) );
+                    auto const b = _mm256_loadu_si256( reinterpret_cast< __m256i const* >( in + i + 16 ) );
+                    auto const packed = _mm256_min_epu8( _mm256_packus_epi16( a, b ), max );
+                    // packing works within each 128 bit lane, which leaves the middle two quarters swapped
+                    _mm256_storeu_si256( reinterpret_cast< __m256i* >( out + i ), _mm256_permute4x64_epi64( packed, 0b11011000 ) );
+                }
+                return;
+            }
+#elif defined( __SSE2__ )
+            if constexpr ( Vectorised )
+            {
+                auto const max = _mm_set1_epi8( 127 );
+
+                for ( int i = 0; i < size; i += 16 )
+                {
+                    auto const a = _mm_loadu_si128( reinterpret_cast< __m128i const* >( in + i ) );
+                    auto const b = _mm_loadu_si128( reinterpret_cast< __m128i const* >( in + i + 8 ) );
+                    _mm_storeu_si128( reinterpret_cast< __m128i* >( out + i ), _mm_min_epu8( _mm_packus_epi16( a, b ), max ) );
+                }
+                return;
+            }
+#endif
+            for ( int i = 0; i < size; ++i )
+            {
+                out[ i ] = static_cast< uint8_t >( std::clamp< int >( in[ i ], 0, 127 ) );
+            }
+        }
+
+#if defined( __AVX2__ )
+        // sum + the products of a and w added up in fours. Inputs are at most 127, so maddubs' 16 bit pairs never saturate
+        inline __m256i multiplyAdd( __m256i sum, __m256i a, __m256i w )
+        {
+#if defined( __AVXVNNI__ )
+            return _mm256_dpbusd_avx_epi32( sum, a, w );
+#elif defined( __AVX512VNNI__ ) && defined( __AVX512VL__ )
+            return _mm256_dpbusd_epi32( sum, a, w );
+#else
+            return _mm256_add_epi32( sum, _mm256_madd_epi16( _mm256_maddubs_epi16( a, w ), _mm256_set1_epi16( 1 ) ) );
+#endif
+        }
+#endif
+
+        template< bool Vectorised = true >
+        inline int32_t dot( uint8_t const* in, int8_t const* weights, int size )
+        {
+#if defined( __AVX2__ )
+            if constexpr ( Vectorised )
+            {
+                auto sum = _mm256_setzero_si256();
+
+                for ( int i = 0; i < size; i += 32 )
+                {
+                    auto const a = _mm256_loadu_si256( reinterpret_cast< __m256i const* >( in + i ) );
+                    auto const w = _mm256_loadu_si256( reinterpret_cast< __m256i const* >( weights + i ) );
+                    sum = multiplyAdd( sum, a, w );
+                }
+
+                auto s = _mm_add_epi32( _mm256_castsi256_si128( sum ), _mm256_extracti128_si256( sum, 1 ) );
+                s = _mm_add_epi32( s, _mm_shuffle_epi32( s, 0b01001110 ) );
+                s = _mm_add_epi32( s, _mm_shuffle_epi32( s, 0b10110001 ) );
+                return _mm_cvtsi128_si32( s );
+            }
+#elif defined( __SSSE3__ )
+            // inputs are at most 127, so maddubs' 16 bit pairs never saturate
+            if constexpr ( Vectorised )
+            {
+                auto const ones = _mm_set1_epi16( 1 );
+                auto sum = _mm_setzero_si128();
+
+                for ( int i = 0; i < size; i += 16 )
+                {
+                    auto const a = _mm_loadu_si128( reinterpret_cast< __m128i const* >( in + i ) );
+                    auto const w = _mm_loadu_si128( reinterpret_cast< __m128i const* >( weights + i ) );
+                    sum = _mm_add_epi32( sum, _mm_madd_epi16( _mm_maddubs_epi16( a, w ), ones ) );
+                }
+
+                sum = _mm_add_epi32( sum, _mm_shuffle_epi32( sum, 0b01001110 ) );
+                sum = _mm_add_epi32( sum, _mm_shuffle_epi32( sum, 0b10110001 ) );
+                return _mm_cvtsi128_si32( sum );
+            }
+#elif defined( __SSE2__ )
+            // without maddubs both sides are widened to 16 bits first
+            if constexpr ( Vectorised )
+            {
+                auto const zero = _mm_setzero_si128();
+                auto sum = _mm_setzero_si128();
+
+                for ( int i = 0; i < size; i += 16 )
+                {
+                    auto const a = _mm_loadu_si128( reinterpret_cast< __m128i const* >( in + i ) );
+                    auto const w = _mm_loadu_si128( reinterpret_cast< __m128i const* >( weights + i ) );
+                    auto const sign = _mm_cmpgt_epi8( zero, w );
+
+                    sum = _mm_add_epi32( sum, _mm_madd_epi16( _mm_unpacklo_epi8( a, zero ), _mm_unpacklo_epi8( w, sign ) ) );
+                    sum = _mm_add_epi32( sum, _mm_madd_epi16( _mm_unpackhi_epi8( a, zero ), _mm_unpackhi_epi8( w, sign ) ) );
+                }
+
+                sum = _mm_add_epi32( sum, _mm_shuffle_epi32( sum, 0b01001110 ) );
+                sum = _mm_add_epi32( sum, _mm_shuffle_epi32( sum, 0b10110001 ) );
+                return _mm_cvtsi128_si32( sum );
+            }
+#endif
+            int32_t sum = 0;
+
+            for ( int i = 0; i < size; ++i )
+            {
+                sum += in[ i ] * weights[ i ];
+            }
+
+            return sum;
+        }
+
+        // A dense layer followed by the clipped relu, out = clamp( ( biases + weights * in ) >> WeightShift, 0, 127 )
+        template< bool Vectorised = true, size_t In, size_t Out >
+        inline void affine( std::array< uint8_t, In > const& in, std::array< int8_t, In * Out > const& weights,
+                            std::array< int32_t, Out > const& biases, std::array< uint8_t, Out >& out )
+        {
+#if defined( __AVX2__ )
+            if constexpr ( Vectorised )
+            {
+                // four rows at a time share the loads of the input and one horizontal add at the end
+                for ( size_t j = 0; j < Out; j += 4 )
+                {
+                    auto const* w = weights.data() + j * In;
+                    auto s0 = _mm256_setzero_si256();
+                    auto s1 = _mm256_setzero_si256();
+                    auto s2 = _mm256_setzero_si256();
+                    auto s3 = _mm256_setzero_si256();
+
+                    for ( size_t i = 0; i < In; i += 32 )
+                    {
+                        auto const a = _mm256_loadu_si256( reinterpret_cast< __m256i const* >( in.data() + i ) );
+
+                        s0 = multiplyAdd( s0, a, _mm256_loadu_si256( reinterpret_cast< __m256i const* >( w + i ) ) );
+                        s1 = multiplyAdd( s1, a, _mm256_loadu_si256( reinterpret_cast< __m256i const* >( w + In + i ) ) );
+                        s2 = multiplyAdd( s2, a, _mm256_loadu_si256( reinterpret_cast< __m256i const* >( w + 2 * In + i ) ) );
+                        s3 = multiplyAdd( s3, a, _mm256_loadu_si256( reinterpret_cast< __m256i const* >( w + 3 * In + i ) ) );
+                    }
+
+                    auto const pairs = _mm256_hadd_epi32( _mm256_hadd_epi32( s0, s1 ), _mm256_hadd_epi32( s2, s3 ) );
+                    auto row = _mm_add_epi32( _mm256_castsi256_si128( pairs ), _mm256_extracti128_si256( pairs, 1 ) );
+                    row = _mm_add_epi32( row, _mm_loadu_si128( reinterpret_cast< __m128i const* >( biases.data() + j ) ) );
+                    row = _mm_srai_epi32( row, WeightShift );
+
+                    alignas( 16 ) std::array< int32_t, 4 > values;
+                    _mm_store_si128( reinterpret_cast< __m128i* >( values.data() ), row );
+
+                    for ( size_t k = 0; k < 4; ++k )
+                    {
+                        out[ j + k ] = static_cast< uint8_t >( std::clamp( values[ k ], 0, 127 ) );
+                    }
+                }
+                return;
+            }
+#endif
+            for ( size_t j = 0; j < Out; ++j )
+            {
+                auto const sum = biases[ j ] + dot< Vectorised >( in.data(), weights.data() + j * In, In );
+                out[ j ] = static_cast< uint8_t >( std::clamp( sum >> WeightShift, 0, 127 ) );
+            }
+        }
+    }
+
+    /*
+        The first layer's output for each side, indexed by isAi() like evaluation::Accumulator, and
+        the king square each side's half was computed from. A side whose king has been taken has no
+        valid half, and the position is left to the hand written evaluation.
+    */
+    struct Accumulator
+    {
+        std::array< std::array< int16_t, HalfDimensions >, 2 > values;
+        std::array< int16_t, 2 > kings = { NoKing, NoKing };
+
+        static constexpr int featureIndex( bool side, int16_t king, Piece p, int16_t idx )
+        {
+            auto const orient = [side]( int16_t square ) { return side ? square ^ 56 : square; };
+            auto const theirs = p.isAi() != side;
+
+            return orient( king ) * PieceFeatures + ( ( static_cast< int >( p.type ) - 1 ) * 2 + theirs ) * 64 + orient( idx );
+        }
+
+        bool hasBothKings() const
+        {
+            return kings[ 0 ] != NoKing && kings[ 1 ] != NoKing;
+        }
+
+        void add( Network const& net, Piece p, int16_t idx )
+        {
+            update< true >( net, p, idx );
+        }
+
+        void remove( Network const& net, Piece p, int16_t idx )
+        {
+            update< false >( net, p, idx );
+        }
+
+        // Recomputes one side's half from scratch, which a king move needs as every input of that side changes
+        void refresh( Network const& net, Piece const* board, bool side )
+        {
+            auto& half = values[ side ];
+            std::copy( net.featureBiases.begin(), net.featureBiases.end(), half.begin() );
+
+            if ( kings[ side ] == NoKing )
+                return;
+
+            for ( int16_t i = 0; i < 64; ++i )
+            {
+                auto const p = board[ i ];
+
+                if ( !p.isNull() && p.type != piece::Type::King )
+                    simd::addColumn( half.data(), column( net, featureIndex( side, kings[ side ], p, i ) ) );
+            }
+        }
+
+        static Accumulator fromBoard( Network const& net, Piece const* board )
+        {
+            Accumulator a;
+
+            for ( int16_t i = 0; i < 64; ++i )
+            {
+                if ( board[ i ].type == piece::Type::King )
+                    a.kings[ board[ i ].isAi() ] = i;
+            }
+
+            a.refresh( net, board, false );
+            a.refresh( net, board, true );
+
+            return a;
+        }
+
+        // Equal halves, ignoring a half that isn't valid
+        bool operator==( Accumulator const& other ) const
+        {
+            for ( bool const side : { false, true } )
+            {
+                if ( kings[ side ] != other.kings[ side ] )
+                    return false;
+
+                if ( kings[ side ] != NoKing && values[ side ] != other.values[ side ] )
+                    return false;
+            }
+
+            return true;
+        }
+
+    private:
+        static int16_t const* column( Network const& net, int feature )
+        {
+            return net.featureWeights.data() + feature * HalfDimensions;
+        }
+
+        template< bool Add >
+        void update( Network const& net, Piece p, int16_t idx )
+        {
+            if ( p.isNull() || p.type == piece::Type::King )
+                return;
+
+            for ( bool const side : { false, true } )
+            {
+                if ( kings[ side ] == NoKing )
+                    continue;
+
+                auto const c = column( net, featureIndex( side, kings[ side ], p, idx ) );
+
+                if constexpr ( Add )
+                    simd::addColumn( values[ side ].data(), c );
+                else
+                    simd::subColumn( values[ side ].data(), c );
+            }
+        }
+    };
+
+    // Updates the accumulator for board::movePiece, after the board has been changed
+    inline void onMove( Network const& net, Accumulator& acc, Piece const* board, int16_t fromIdx, int16_t dstIdx, Piece fromB4, Piece dstB4 )
+    {
+        if ( dstB4.type == piece::Type::King )
+            acc.kings[ dstB4.isAi() ] = NoKing;
+
+        acc.remove( net, fromB4, fromIdx );
+        acc.remove( net, dstB4, dstIdx );
+        acc.add( net, board[ dstIdx ], dstIdx );
+
+        if ( fromB4.type == piece::Type::King )
+        {
+            acc.kings[ fromB4.isAi() ] = dstIdx;
+            acc.refresh( net, board, fromB4.isAi() );
+        }
+    }
+
+    // Reverses onMove, after the board has been put back; moved is the piece that was on dstIdx
+    inline void onUndo( Network const& net, Accumulator& acc, Piece const* board, int16_t fromIdx, int16_t dstIdx, Piece moved )
+    {
+        auto const fromB4 = board[ fromIdx ];
+        auto const dstB4 = board[ dstIdx ];
+
+        acc.remove( net, moved, dstIdx );
+        acc.add( net, dstB4, dstIdx );
+        acc.add( net, fromB4, fromIdx );
+
+        if ( fromB4.type == piece::Type::King )
+        {
+            acc.kings[ fromB4.isAi() ] = fromIdx;
+            acc.refresh( net, board, fromB4.isAi() );
+        }
+
+        if ( dstB4.type == piece::Type::King )
+        {
+            acc.kings[ dstB4.isAi() ] = dstIdx;
+            acc.refresh( net, board, dstB4.isAi() );
+        }
+    }
+
+    // From the point of view of the side to move, whose half goes first. Needs both kings on the board
+    template< bool Vectorised = true >
+    inline int evaluate( Network const& net, Accumulator const& acc, bool aiToMove )
+    {
+        alignas( 32 ) std::array< uint8_t, HalfDimensions * 2 > input;
+        alignas( 32 ) std::array< uint8_t, Hidden1 > hidden1;
+        alignas( 32 ) std::array< uint8_t, Hidden2 > hidden2;
+
+        simd::clippedRelu< Vectorised >( acc.values[ aiToMove ].data(), input.data(), HalfDimensions );
+        simd::clippedRelu< Vectorised >( acc.values[ !aiToMove ].data(), input.data() + HalfDimensions, HalfDimensions );
+
+        simd::affine< Vectorised >( input, net.hidden1Weights, net.hidden1Biases, hidden1 );
+        simd::affine< Vectorised >( hidden1, net.hidden2Weights, net.hidden2Biases, hidden2 );
+
+        auto const output = net.outputBias + simd::dot< Vectorised >( hidden2.data(), net.outputWeights.data(), Hidden2 );
+
+        return output / OutputScale;
+    }
+}
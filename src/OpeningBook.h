@@ -0,0 +1,130 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <optional>
+#include <span>
+
+#include "MappedFile.h"
+#include "MoveList.h"
+
+/*
+    An opening book made by tools/bookgen: the moves played from each position of a set of games,
+    keyed by Position::key and weighted by how well they scored. The file is a Header followed by
+    Entries sorted by key, so it's used straight from the mapping with a binary search.
+*/
+namespace book
+{
+    // Books from before positions were keyed with their castling rights and en passant square aren't read
+    constexpr char Magic[ 8 ] = { 'C', 'H', 'E', 'S', 'S', 'B', 'K', '2' };
+
+    // Book files are little endian, which is every machine this builds for
+    static_assert( std::endian::native == std::endian::little );
+
+    struct Header
+    {
+        char magic[ 8 ];
+        uint64_t entryCount;
+    };
+
+    struct Entry
+    {
+        uint64_t key;
+        // PackedMove::raw()
+        uint16_t move;
+        // two points a win, one a draw, for the side that played the move
+        uint16_t weight;
+        // how many games played it
+        uint32_t games;
+    };
+
+    static_assert( sizeof( Header ) == 16 && sizeof( Entry ) == 16 );
+
+    class Book
+    {
+    public:
+        // False, leaving the book empty, if the file isn't a book
+        bool open( std::filesystem::path const& path )
+        {
+            m_entries = {};
+
+            if ( !m_file.open( path ) )
+                return false;
+
+            auto const data = m_file.data();
+
+            Header header;
+
+            if ( data.size() < sizeof( Header ) )
+            {
+                m_file.close();
+                return false;
+            }
+
+            std::memcpy( &header, data.data(), sizeof( Header ) );
+
+            // divided rather than multiplied out, so a corrupt count can't wrap around to the file's size
+            auto const bytes = data.size() - sizeof( Header );
+
+            if ( std::memcmp( header.magic, Magic, sizeof( Magic ) ) != 0
+              || bytes % sizeof( Entry ) != 0 || header.entryCount != bytes / sizeof( Entry ) )
+            {
+                m_file.close();
+                return false;
+            }
+
+            m_entries = { reinterpret_cast< Entry const* >( data.data() + sizeof( Header ) ), header.entryCount };
+
+            return true;
+        }
+
+        size_t size() const { return m_entries.size(); }
+
+        // Every move the book has for a position
+        std::span< Entry const > find( uint64_t key ) const
+        {
+            auto const [begin, end] = std::equal_range( m_entries.begin(), m_entries.end(), Entry{ key, 0, 0, 0 },
+                []( Entry const& a, Entry const& b ) { return a.key < b.key; } );
+
+            return { begin, end };
+        }
+
+        // One of the position's moves, picked with a chance in proportion to its weight; random is any 64 bit number
+        std::optional< PackedMove > pick( uint64_t key, uint64_t random ) const
+        {
+            auto const moves = find( key );
+
+            uint64_t total = 0;
+
+            for ( auto const& e : moves )
+            {
+                total += e.weight;
+            }
+
+            if ( total == 0 )
+                return std::nullopt;
+
+            auto target = random % total;
+
+            for ( auto const& e : moves )
+            {
+                if ( target < e.weight )
+                    return PackedMove::fromRaw( e.move );
+
+                target -= e.weight;
+            }
+
+            return std::nullopt;
+        }
+
+    private:
+        MappedFile m_file;
+        std::span< Entry const > m_entries;
+    };
+
+    // The book makeMove plays from, empty unless one was opened
+    inline Book openingBook;
+}
@@ -0,0 +1,372 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <tuple>
+#include <string_view>
+
+#include "Piece.h"
+#include "board.h"
+#include "Bitboard.h"
+#include "AttackMap.h"
+#include "Zobrist.h"
+#include "Evaluation.h"
+#include "Nnue.h"
+
+/*
+    The board as seen by the search: the squares and the same pieces as bitboards, the side to move,
+    and an incrementally updated hash key and evaluation. The bitboards double as the piece lists, so
+    a side's pieces are walked bit by bit rather than by scanning the squares.
+*/
+struct Position
+{
+    static constexpr int16_t NoKing = -1;
+    static constexpr int16_t NoEnPassant = -1;
+
+    std::array< Piece, 64 > board;
+    bitboard::Boards bitboards;
+    // each side's king square, indexed by isAi, or NoKing once it's been taken
+    std::array< int16_t, 2 > kings = { NoKing, NoKing };
+    attackmap::Map attacks;
+    uint64_t key = 0;
+    evaluation::Accumulator eval;
+    // only kept up to date while a network is loaded
+    nnue::Accumulator nnue;
+    bool aiToMove = true;
+    // the board::castling rights either side still has
+    uint8_t castling = 0;
+    // the square a pawn just crossed moving two squares, only while a pawn of the side to move could take it there
+    int16_t enPassant = NoEnPassant;
+
+    // kings included, so small endgames are quick to spot
+    constexpr int pieceCount() const
+    {
+        return bitboard::count( bitboards.occupied );
+    }
+
+    constexpr int pieceCount( bool isAi, piece::Type type ) const
+    {
+        return bitboard::count( bitboards.of( isAi, type ) );
+    }
+
+    constexpr bool hasKing( bool isAi ) const
+    {
+        return kings[ isAi ] != NoKing;
+    }
+
+    constexpr bool isInCheck( bool isAi ) const
+    {
+        return hasKing( isAi ) && attacks.isAttacked( kings[ isAi ], !isAi );
+    }
+
+    // What key is kept up to date as, worked out from scratch
+    constexpr uint64_t computeKey() const
+    {
+        return zobrist::hash( board.data(), aiToMove ) ^ zobrist::castlingKey( castling ) ^ zobrist::enPassantKey( enPassant );
+    }
+
+    /*
+        Rights whose king or rook isn't on its starting square are dropped, and so is an en passant
+        square no pawn of the side to move can take on, so equal positions get equal keys.
+    */
+    static Position fromBoard( Piece const* b, bool aiToMove, uint8_t castling = 0, int16_t enPassant = NoEnPassant )
+    {
+        Position pos;
+
+        std::copy( b, b + 64, pos.board.begin() );
+        pos.bitboards = bitboard::Boards::fromBoard( b );
+
+        for ( bool const isAi : { false, true } )
+        {
+            if ( auto const king = pos.bitboards.of( isAi, piece::Type::King ) )
+                pos.kings[ isAi ] = bitboard::first( king );
+        }
+
+        pos.attacks = attackmap::Map::fromBoards( pos.bitboards );
+
+        for ( size_t i = 0; i < board::castling::Castles.size(); ++i )
+        {
+            auto const& c = board::castling::Castles[ i ];
+            auto const isAi = i >= 2;
+
+            if ( b[ c.kingFrom ] == Piece{ !isAi, piece::Type::King } && b[ c.rookFrom ] == Piece{ !isAi, piece::Type::Rook } )
+                pos.castling |= castling & c.right;
+        }
+
+        if ( enPassant != NoEnPassant && ( bitboard::PawnAttacks[ !aiToMove ][ enPassant ] & pos.bitboards.of( aiToMove, piece::Type::Pawn ) ) )
+            pos.enPassant = enPassant;
+
+        pos.aiToMove = aiToMove;
+        pos.key = pos.computeKey();
+        pos.eval = evaluation::Accumulator::fromBitboards( pos.bitboards );
+
+        if ( nnue::network )
+            pos.nnue = nnue::Accumulator::fromBoard( *nnue::network, b );
+
+        return pos;
+    }
+
+    // The user moves first, and either side may castle either way
+    static Position startPosition()
+    {
+        return fromBoard( board::init::DefaultBoard.data(), false, board::castling::AllRights );
+    }
+
+    /*
+        Reads a FEN string up to its en passant square. The user plays the upper case (white) pieces
+        up the board from rank 1, the ai the lower case ones down from rank 8.
+    */
+    static Position fromFen( std::string_view fen )
+    {
+        std::array< Piece, 64 > b;
+        b.fill( Piece{} );
+
+        size_t c = 0;
+        int16_t index = 0;
+
+        for ( ; c < fen.size() && fen[ c ] != ' '; ++c )
+        {
+            auto const ch = fen[ c ];
+
+            if ( '1' <= ch && ch <= '8' )
+            {
+                index += ch - '0';
+                continue;
+            }
+
+            auto const lower = static_cast< char >( ch | 0x20 );
+            auto const type = lower == 'k' ? piece::Type::King
+                            : lower == 'q' ? piece::Type::Queen
+                            : lower == 'b' ? piece::Type::Bishop
+                            : lower == 'n' ? piece::Type::Knight
+                            : lower == 'r' ? piece::Type::Rook
+                            : lower == 'p' ? piece::Type::Pawn
+                            : piece::Type::Null;
+
+            if ( type == piece::Type::Null || index >= 64 )
+                continue;
+
+            b[ index++ ] = Piece{ ch != lower, type };
+        }
+
+        // the side to move, castling rights and en passant square
+        std::array< std::string_view, 3 > fields;
+
+        for ( auto& field : fields )
+        {
+            c = std::min( fen.find_first_not_of( ' ', c ), fen.size() );
+
+            auto const end = std::min( fen.find( ' ', c ), fen.size() );
+            field = fen.substr( c, end - c );
+            c = end;
+        }
+
+        uint8_t castling = 0;
+
+        for ( auto const ch : fields[ 1 ] )
+        {
+            if ( auto const right = std::string_view( "KQkq" ).find( ch ); right != std::string_view::npos )
+                castling |= 1 << right;
+        }
+
+        auto enPassant = NoEnPassant;
+        auto const square = fields[ 2 ];
+
+        if ( square.size() == 2 && 'a' <= square[ 0 ] && square[ 0 ] <= 'h' && '1' <= square[ 1 ] && square[ 1 ] <= '8' )
+            enPassant = static_cast< int16_t >( ( '8' - square[ 1 ] ) * 8 + ( square[ 0 ] - 'a' ) );
+
+        return fromBoard( b.data(), fields[ 0 ] == "b", castling, enPassant );
+    }
+};
+
+namespace board
+{
+    // What movePiece on a position changed, for undoMove to put back
+    struct Undo
+    {
+        Piece fromB4;
+        Piece dstB4;
+        // the piece taken, which only en passant takes from a square other than dst
+        Piece captured;
+        bool promoted;
+        uint8_t castling;
+        int16_t enPassant;
+    };
+
+    namespace details
+    {
+        // Moves a single piece, updating the bitboards, attack map, kings, evaluation and the pieces' part of the hash key
+        inline std::tuple< Piece, Piece, bool > step( Position& pos, int16_t fromIdx, int16_t dstIdx, piece::Type promotion )
+        {
+            auto const fromB4 = pos.board[ fromIdx ];
+            auto const dstB4 = pos.board[ dstIdx ];
+            auto const promoted = isPromotion( pos.board.data(), fromIdx, dstIdx );
+
+            pos.board[ dstIdx ] = promoted ? Piece{ fromB4.isBlack, promotion } : fromB4;
+            pos.board[ fromIdx ] = Piece{};
+
+            auto const moved = pos.board[ dstIdx ];
+
+            pos.key ^= zobrist::pieceKey( fromB4, fromIdx )
+                     ^ zobrist::pieceKey( dstB4, dstIdx )
+                     ^ zobrist::pieceKey( moved, dstIdx );
+
+            pos.eval.remove( fromB4, fromIdx );
+            pos.eval.remove( dstB4, dstIdx );
+            pos.eval.add( moved, dstIdx );
+
+            pos.bitboards.toggle( fromB4, fromIdx );
+            pos.bitboards.toggle( dstB4, dstIdx );
+            pos.bitboards.toggle( moved, dstIdx );
+
+            pos.attacks.onMove( pos.bitboards, fromIdx, dstIdx, fromB4, dstB4, moved );
+
+            if ( fromB4.type == piece::Type::King )
+                pos.kings[ fromB4.isAi() ] = dstIdx;
+
+            if ( dstB4.type == piece::Type::King )
+                pos.kings[ dstB4.isAi() ] = Position::NoKing;
+
+            if ( nnue::network )
+                nnue::onMove( *nnue::network, pos.nnue, pos.board.data(), fromIdx, dstIdx, fromB4, dstB4 );
+
+            return { fromB4, dstB4, promoted };
+        }
+
+        // Reverses step; the attack map is worked out again only if UndoAttacks, as the search puts back a copy
+        template< bool UndoAttacks >
+        void unstep( Position& pos, int16_t fromIdx, int16_t dstIdx, Piece fromB4, Piece dstB4 )
+        {
+            auto const moved = pos.board[ dstIdx ];
+
+            pos.key ^= zobrist::pieceKey( fromB4, fromIdx )
+                     ^ zobrist::pieceKey( dstB4, dstIdx )
+                     ^ zobrist::pieceKey( moved, dstIdx );
+
+            pos.eval.remove( moved, dstIdx );
+            pos.eval.add( dstB4, dstIdx );
+            pos.eval.add( fromB4, fromIdx );
+
+            pos.bitboards.toggle( moved, dstIdx );
+            pos.bitboards.toggle( dstB4, dstIdx );
+            pos.bitboards.toggle( fromB4, fromIdx );
+
+            if ( fromB4.type == piece::Type::King )
+                pos.kings[ fromB4.isAi() ] = fromIdx;
+
+            if ( dstB4.type == piece::Type::King )
+                pos.kings[ dstB4.isAi() ] = dstIdx;
+
+            pos.board[ fromIdx ] = fromB4;
+            pos.board[ dstIdx ]  = dstB4;
+
+            if constexpr ( UndoAttacks )
+                pos.attacks.onUndo( pos.bitboards, fromIdx, dstIdx, fromB4, dstB4, moved );
+
+            if ( nnue::network )
+                nnue::onUndo( *nnue::network, pos.nnue, pos.board.data(), fromIdx, dstIdx, moved );
+        }
+
+        template< bool UndoAttacks >
+        void undo( Position& pos, int16_t fromIdx, int16_t dstIdx, Undo const& u )
+        {
+            pos.key ^= zobrist::castlingKey( pos.castling ) ^ zobrist::enPassantKey( pos.enPassant )
+                     ^ zobrist::castlingKey( u.castling ) ^ zobrist::enPassantKey( u.enPassant )
+                     ^ zobrist::AiToMove;
+
+            if ( auto const castle = castling::find( u.fromB4, fromIdx, dstIdx ) )
+            {
+                unstep< UndoAttacks >( pos, fromIdx, dstIdx, u.fromB4, Piece{} );
+                unstep< UndoAttacks >( pos, castle->rookFrom, castle->rookDst, pos.board[ castle->rookDst ], Piece{} );
+            }
+            else if ( u.captured != u.dstB4 )
+            {
+                auto const victim = enPassantVictim( fromIdx, dstIdx );
+
+                unstep< UndoAttacks >( pos, victim, dstIdx, u.fromB4, Piece{} );
+                unstep< UndoAttacks >( pos, fromIdx, victim, u.fromB4, u.captured );
+            }
+            else
+            {
+                unstep< UndoAttacks >( pos, fromIdx, dstIdx, u.fromB4, u.dstB4 );
+            }
+
+            pos.castling = u.castling;
+            pos.enPassant = u.enPassant;
+            pos.aiToMove = !pos.aiToMove;
+        }
+    }
+
+    /*
+        Same as movePiece on a plain board, but also passes the turn and updates the bitboards, attack
+        map, hash key, evaluation, castling rights and en passant square. Castling is made as the rook's
+        move then the king's, and en passant as taking the pawn alongside then stepping forward, so
+        every update only ever has to follow one piece at a time.
+    */
+    inline Undo movePiece( Position& pos, int16_t fromIdx, int16_t dstIdx, piece::Type promotion = piece::Type::Queen )
+    {
+        Undo undo = { pos.board[ fromIdx ], pos.board[ dstIdx ], pos.board[ dstIdx ], false, pos.castling, pos.enPassant };
+
+        if ( auto const castle = castling::find( undo.fromB4, fromIdx, dstIdx ) )
+        {
+            details::step( pos, castle->rookFrom, castle->rookDst, promotion );
+            details::step( pos, fromIdx, dstIdx, promotion );
+        }
+        else if ( isEnPassant( pos.board.data(), fromIdx, dstIdx ) )
+        {
+            auto const victim = enPassantVictim( fromIdx, dstIdx );
+
+            undo.captured = pos.board[ victim ];
+
+            details::step( pos, fromIdx, victim, promotion );
+            details::step( pos, victim, dstIdx, promotion );
+        }
+        else
+        {
+            undo.promoted = std::get< 2 >( details::step( pos, fromIdx, dstIdx, promotion ) );
+        }
+
+        pos.castling &= castling::KeptRights[ fromIdx ] & castling::KeptRights[ dstIdx ];
+        pos.enPassant = Position::NoEnPassant;
+
+        auto const isAi = undo.fromB4.isAi();
+
+        if ( undo.fromB4.type == piece::Type::Pawn && ( fromIdx - dstIdx == 16 || dstIdx - fromIdx == 16 ) )
+        {
+            auto const crossed = static_cast< int16_t >( ( fromIdx + dstIdx ) / 2 );
+
+            if ( bitboard::PawnAttacks[ isAi ][ crossed ] & pos.bitboards.of( !isAi, piece::Type::Pawn ) )
+                pos.enPassant = crossed;
+        }
+
+        // most moves leave the rights alone
+        if ( pos.castling != undo.castling )
+            pos.key ^= zobrist::castlingKey( undo.castling ) ^ zobrist::castlingKey( pos.castling );
+
+        pos.key ^= zobrist::enPassantKey( undo.enPassant ) ^ zobrist::enPassantKey( pos.enPassant ) ^ zobrist::AiToMove;
+
+        pos.aiToMove = !pos.aiToMove;
+
+        return undo;
+    }
+
+    // Whether the piece is still on the board, without looking at every square
+    constexpr bool hasPiece( Position const& pos, Piece piece )
+    {
+        return !piece.isNull() && pos.bitboards.of( piece.isAi(), piece.type ) != 0;
+    }
+
+    // Undoes movePiece( pos, fromIdx, dstIdx ) given what it returned
+    inline void undoMove( Position& pos, int16_t fromIdx, int16_t dstIdx, Undo const& undo )
+    {
+        details::undo< true >( pos, fromIdx, dstIdx, undo );
+    }
+
+    // The same, putting back the attack map from before the move rather than working it out again
+    inline void undoMove( Position& pos, int16_t fromIdx, int16_t dstIdx, Undo const& undo, attackmap::Map const& attacksB4 )
+    {
+        details::undo< false >( pos, fromIdx, dstIdx, undo );
+
+        pos.attacks = attacksB4;
+    }
+}
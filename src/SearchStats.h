@@ -0,0 +1,184 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+
+#include "MoveOrdering.h"
+
+namespace stats
+{
+#if defined( CHESS_NO_STATS )
+    constexpr bool Enabled = false;
+#else
+    constexpr bool Enabled = true;
+#endif
+
+    constexpr int MaxDepth = 64;
+
+    /*
+        What one search did. Every thread counts into its own copy, and the copies are added together
+        once the search is over, so counting never contends. In a CHESS_NO_STATS build the counting
+        compiles away and everything reads 0.
+    */
+    struct Search
+    {
+        // positions visited during each iteration of iterative deepening, quiescence included
+        std::array< uint64_t, MaxDepth + 1 > nodesByDepth{};
+        std::array< uint64_t, MaxDepth + 1 > quiescenceNodesByDepth{};
+        uint64_t ttProbes = 0;
+        uint64_t ttHits = 0;
+        uint64_t ttStores = 0;
+        uint64_t tablebaseHits = 0;
+        ordering::Stats ordering;
+        // of the whole search, filled in once it's over
+        int depth = 0;
+        double seconds = 0;
+
+        void onNode( int iteration )
+        {
+            if constexpr ( Enabled )
+                nodesByDepth[ iteration ] += 1;
+        }
+
+        void onQuiescenceNode( int iteration )
+        {
+            if constexpr ( Enabled )
+            {
+                nodesByDepth[ iteration ] += 1;
+                quiescenceNodesByDepth[ iteration ] += 1;
+            }
+        }
+
+        void onProbe( bool hit )
+        {
+            if constexpr ( Enabled )
+            {
+                ttProbes += 1;
+                ttHits += hit;
+            }
+        }
+
+        void onStore()
+        {
+            if constexpr ( Enabled )
+                ttStores += 1;
+        }
+
+        void onTablebaseHit()
+        {
+            if constexpr ( Enabled )
+                tablebaseHits += 1;
+        }
+
+        void onCutoff( ordering::Source source, bool firstMove )
+        {
+            if constexpr ( Enabled )
+                ordering.onCutoff( source, firstMove );
+        }
+
+        void onGenerate( uint64_t moves, bool newNode )
+        {
+            if constexpr ( Enabled )
+            {
+                ordering.movesGenerated += moves;
+                ordering.nodesGeneratingMoves += newNode;
+            }
+        }
+
+        uint64_t nodes() const
+        {
+            uint64_t total = 0;
+
+            for ( auto const n : nodesByDepth )
+            {
+                total += n;
+            }
+
+            return total;
+        }
+
+        uint64_t quiescenceNodes() const
+        {
+            uint64_t total = 0;
+
+            for ( auto const n : quiescenceNodesByDepth )
+            {
+                total += n;
+            }
+
+            return total;
+        }
+
+        double nodesPerSecond() const
+        {
+            return seconds > 0 ? nodes() / seconds : 0.0;
+        }
+
+        // How many times more nodes the last completed iteration took than the one before
+        double effectiveBranchingFactor() const
+        {
+            if ( depth < 1 || nodesByDepth[ depth - 1 ] == 0 )
+                return 0.0;
+
+            return static_cast< double >( nodesByDepth[ depth ] ) / nodesByDepth[ depth - 1 ];
+        }
+
+        // Of the nodes that searched moves, how many failed high
+        double betaCutoffRate() const
+        {
+            return ordering.nodesGeneratingMoves == 0 ? 0.0 : static_cast< double >( ordering.betaCutoffs ) / ordering.nodesGeneratingMoves;
+        }
+
+        double firstMoveCutoffRate() const
+        {
+            return ordering.firstMoveCutoffRate();
+        }
+
+        double ttHitRate() const
+        {
+            return ttProbes == 0 ? 0.0 : static_cast< double >( ttHits ) / ttProbes;
+        }
+
+        Search& operator+=( Search const& other )
+        {
+            for ( size_t i = 0; i < nodesByDepth.size(); ++i )
+            {
+                nodesByDepth[ i ] += other.nodesByDepth[ i ];
+                quiescenceNodesByDepth[ i ] += other.quiescenceNodesByDepth[ i ];
+            }
+
+            ttProbes += other.ttProbes;
+            ttHits += other.ttHits;
+            ttStores += other.ttStores;
+            tablebaseHits += other.tablebaseHits;
+            ordering += other.ordering;
+
+            return *this;
+        }
+    };
+
+    inline std::ostream& operator<<( std::ostream& os, Search const& s )
+    {
+        if constexpr ( !Enabled )
+        {
+            os << "search statistics are compiled out\n";
+            return os;
+        }
+
+        os << "depth " << s.depth << ", " << s.nodes() << " nodes (" << s.quiescenceNodes() << " in quiescence), "
+           << static_cast< uint64_t >( s.nodesPerSecond() ) << " nodes/s, branching factor " << s.effectiveBranchingFactor() << "\n";
+
+        for ( int d = 0; d <= MaxDepth; ++d )
+        {
+            if ( s.nodesByDepth[ d ] != 0 )
+                os << "  depth " << d << ": " << s.nodesByDepth[ d ] << " nodes, " << s.quiescenceNodesByDepth[ d ] << " in quiescence\n";
+        }
+
+        os << "beta cutoffs " << 100.0 * s.betaCutoffRate() << "% of nodes, " << 100.0 * s.firstMoveCutoffRate() << "% on the first move\n"
+           << "hash table " << s.ttProbes << " probes, " << s.ttHits << " hits (" << 100.0 * s.ttHitRate() << "%), " << s.ttStores << " stores\n"
+           << "tablebase hits " << s.tablebaseHits << "\n";
+
+        return os;
+    }
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+#include "Piece.h"
+#include "Bitboard.h"
+
+namespace exchange
+{
+    using Values = std::array< int, 7 >;
+
+    namespace details
+    {
+        // Cheapest first, the order the sides recapture in
+        constexpr std::array RecaptureOrder = {
+            piece::Type::Pawn,
+            piece::Type::Knight,
+            piece::Type::Bishop,
+            piece::Type::Rook,
+            piece::Type::Queen,
+            piece::Type::King
+        };
+
+        // The square of the side's least valuable piece among attackers, and its type, or -1
+        constexpr std::pair< int16_t, piece::Type > findLeastValuableAttacker( bitboard::Boards const& b, bitboard::Bitboard attackers, bool isAi )
+        {
+            for ( auto const type : RecaptureOrder )
+            {
+                if ( auto const found = attackers & b.of( isAi, type ) )
+                    return { bitboard::first( found ), type };
+            }
+
+            return { -1, piece::Type::Null };
+        }
+    }
+
+    /*
+        Static exchange evaluation: the material the side moving from "from" wins if both sides keep
+        recapturing on "dst" with their least valuable attacker, each stopping when it stops paying.
+        Taking a piece off the occupied set uncovers the sliders behind it.
+    */
+    constexpr int evaluate( bitboard::Boards const& b, Piece const* board, int16_t from, int16_t dst, Values const& values )
+    {
+        auto const valueOf = [&values]( Piece p )
+        {
+            return p.isNull() ? 0 : values[ static_cast< uint8_t >( p.type ) ];
+        };
+
+        std::array< int, 32 > gain{};
+        int d = 0;
+
+        gain[ 0 ] = valueOf( board[ dst ] );
+
+        auto attackerValue = valueOf( board[ from ] );
+        auto occupied = b.occupied & ~bitboard::squareBit( from );
+        auto isAi = !board[ from ].isAi();
+
+        while ( d + 1 < static_cast< int >( gain.size() ) )
+        {
+            ++d;
+
+            // what the side to move has won if the last capturing piece is taken
+            gain[ d ] = attackerValue - gain[ d - 1 ];
+
+            // neither side can come out ahead by continuing
+            if ( std::max( -gain[ d - 1 ], gain[ d ] ) < 0 )
+                break;
+
+            auto const attackers = bitboard::attackersOf( b, dst, occupied ) & occupied & b.sides[ isAi ];
+            auto const [attacker, type] = details::findLeastValuableAttacker( b, attackers, isAi );
+
+            if ( attacker < 0 )
+                break;
+
+            attackerValue = values[ type ];
+            occupied &= ~bitboard::squareBit( attacker );
+            isAi = !isAi;
+        }
+
+        while ( --d > 0 )
+        {
+            gain[ d - 1 ] = -std::max( -gain[ d - 1 ], gain[ d ] );
+        }
+
+        return gain[ 0 ];
+    }
+}
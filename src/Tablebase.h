@@ -0,0 +1,340 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Piece.h"
+#include "Bitboard.h"
+#include "MappedFile.h"
+
+/*
+    Endgame tables made by tools/tbgen: for every placement of a few pieces and either side to move,
+    whether the side to move wins, loses or draws, and in how many plies. Values are int8s, positive
+    for a win in that many plies, negative for a loss and 0 for a draw. Being checkmated is a loss in
+    1, so mating is a win in 2. Stalemate is a draw.
+
+    A table is named for the user's pieces, a 'v', then the ai's, like "KQvK". Files are a Header
+    followed by the values of every placement with the user to move, then with the ai to move. The
+    rules are the same seen from the other side once the board is turned over, so "KvKQ" is answered
+    by "KQvK" with the colours swapped.
+*/
+namespace tablebase
+{
+    constexpr int MaxPieces = 4;
+
+    // Above anything the evaluation can say, below the search's mate scores
+    constexpr int WinScore = 30000;
+
+    // Tables from before pawns could promote to anything but a queen aren't read
+    constexpr char Magic[ 8 ] = { 'C', 'H', 'E', 'S', 'S', 'T', 'B', '3' };
+
+    struct Header
+    {
+        char magic[ 8 ];
+        uint8_t pieceCount;
+        // type | isAi << 3 of each piece, in Material order
+        uint8_t pieces[ 7 ];
+    };
+
+    static_assert( sizeof( Header ) == 16 );
+
+    constexpr char Letters[] = "KQBNRP";
+
+    // The pieces of a table: the user's then the ai's, each side's king first and then by piece::Type
+    struct Material
+    {
+        std::array< Piece, MaxPieces > pieces{};
+        int count = 0;
+
+        static std::optional< Material > fromName( std::string_view name )
+        {
+            Material m;
+            bool isAi = false;
+
+            for ( auto const c : name )
+            {
+                if ( c == 'v' && !isAi )
+                {
+                    isAi = true;
+                    continue;
+                }
+
+                auto const letter = std::string_view( Letters ).find( c );
+
+                if ( letter == std::string_view::npos || m.count == MaxPieces )
+                    return std::nullopt;
+
+                m.pieces[ m.count++ ] = Piece{ !isAi, static_cast< piece::Type >( letter ) };
+            }
+
+            if ( !isAi || !m.isValid() )
+                return std::nullopt;
+
+            return m;
+        }
+
+        std::string name() const
+        {
+            std::string s;
+
+            for ( int i = 0; i < count; ++i )
+            {
+                if ( i > 0 && pieces[ i ].isAi() && pieces[ i - 1 ].isUser() )
+                    s += 'v';
+
+                s += Letters[ pieces[ i ].type ];
+            }
+
+            return s;
+        }
+
+        // One king each, kings first, in order
+        bool isValid() const
+        {
+            for ( int i = 1; i < count; ++i )
+            {
+                if ( key( pieces[ i ] ) < key( pieces[ i - 1 ] ) )
+                    return false;
+            }
+
+            int kings[ 2 ] = {};
+
+            for ( int i = 0; i < count; ++i )
+            {
+                kings[ pieces[ i ].isAi() ] += pieces[ i ].type == piece::Type::King;
+            }
+
+            return kings[ 0 ] == 1 && kings[ 1 ] == 1 && pieces[ 0 ].type == piece::Type::King;
+        }
+
+        // The same pieces with the colours swapped
+        Material flipped() const
+        {
+            Material m;
+            m.count = count;
+
+            int next = 0;
+
+            for ( bool const isAi : { true, false } )
+            {
+                for ( int i = 0; i < count; ++i )
+                {
+                    if ( pieces[ i ].isAi() == isAi )
+                        m.pieces[ next++ ] = Piece{ isAi, pieces[ i ].type };
+                }
+            }
+
+            return m;
+        }
+
+        // Placements of the pieces with the user's king on the left half of the board
+        constexpr uint64_t placements() const
+        {
+            return uint64_t( 32 ) << ( 6 * ( count - 1 ) );
+        }
+
+        bool operator==( Material const& other ) const
+        {
+            return count == other.count && std::equal( pieces.begin(), pieces.begin() + count, other.pieces.begin() );
+        }
+
+        // Sorts user before ai, then by type
+        static constexpr int key( Piece p )
+        {
+            return p.isAi() * 8 + static_cast< int >( p.type );
+        }
+    };
+
+    // Where each piece of a Material stands
+    using Squares = std::array< int16_t, MaxPieces >;
+
+    /*
+        The table entry of a placement. Turning the board left to right changes nothing, so only
+        placements with the user's king on files a to d are stored and the rest are mirrored.
+    */
+    constexpr uint64_t index( Material const& m, Squares squares, bool aiToMove )
+    {
+        auto const mirror = ( squares[ 0 ] & 7 ) >= 4 ? 7 : 0;
+
+        uint64_t idx = ( squares[ 0 ] >> 3 ) * 4 + ( ( squares[ 0 ] ^ mirror ) & 7 );
+
+        for ( int i = 1; i < m.count; ++i )
+        {
+            idx = idx * 64 + ( squares[ i ] ^ mirror );
+        }
+
+        return aiToMove * m.placements() + idx;
+    }
+
+    // The material on a board and where each piece is, if it's small enough for a table. occupied has a bit for each piece
+    inline std::optional< std::pair< Material, Squares > > materialOf( Piece const* board, bitboard::Bitboard occupied )
+    {
+        if ( bitboard::count( occupied ) > MaxPieces )
+            return std::nullopt;
+
+        Material m;
+        Squares squares{};
+
+        while ( occupied )
+        {
+            auto const i = bitboard::popFirst( occupied );
+            auto const p = board[ i ];
+
+            // insertion sort into Material order, keeping board order between equal pieces
+            auto slot = m.count++;
+
+            for ( ; slot > 0 && Material::key( m.pieces[ slot - 1 ] ) > Material::key( p ); --slot )
+            {
+                m.pieces[ slot ] = m.pieces[ slot - 1 ];
+                squares[ slot ] = squares[ slot - 1 ];
+            }
+
+            m.pieces[ slot ] = p;
+            squares[ slot ] = i;
+        }
+
+        if ( !m.isValid() )
+            return std::nullopt;
+
+        return std::pair{ m, squares };
+    }
+
+    // Positive: the side to move wins, sooner is better. Negative: it loses, later is better
+    constexpr int toScore( int8_t value )
+    {
+        return value > 0 ? WinScore - value
+             : value < 0 ? -WinScore - value
+             : 0;
+    }
+
+    class Tablebases
+    {
+    public:
+        // Maps every table file in directory, returning how many there were
+        size_t load( std::filesystem::path const& directory )
+        {
+            std::error_code error;
+
+            for ( auto const& entry : std::filesystem::directory_iterator( directory, error ) )
+            {
+                if ( entry.path().extension() != ".ctb" )
+                    continue;
+
+                MappedFile file;
+
+                if ( !file.open( entry.path() ) )
+                    continue;
+
+                auto const data = file.data();
+
+                if ( data.size() < sizeof( Header ) )
+                    continue;
+
+                Header header;
+                std::memcpy( &header, data.data(), sizeof( Header ) );
+
+                if ( std::memcmp( header.magic, Magic, sizeof( Magic ) ) != 0 || header.pieceCount > MaxPieces )
+                    continue;
+
+                Material m;
+                m.count = header.pieceCount;
+
+                for ( int i = 0; i < m.count; ++i )
+                {
+                    m.pieces[ i ] = Piece{ !( header.pieces[ i ] >> 3 ), static_cast< piece::Type >( header.pieces[ i ] & 7 ) };
+                }
+
+                if ( !m.isValid() || data.size() != sizeof( Header ) + 2 * m.placements() )
+                    continue;
+
+                add( m, { reinterpret_cast< int8_t const* >( data.data() + sizeof( Header ) ), 2 * m.placements() } );
+                m_files.push_back( std::move( file ) );
+            }
+
+            return m_files.size();
+        }
+
+        // Tables may also live in memory, which is how the generator looks up the ones it made before
+        void add( Material const& m, std::span< int8_t const > values )
+        {
+            m_tables.push_back( { m, values } );
+            m_maxPieces = std::max( m_maxPieces, m.count );
+        }
+
+        // Tables can't help positions with more pieces than this
+        int maxPieces() const { return m_maxPieces; }
+
+        std::optional< int8_t > probe( Piece const* board, bool aiToMove ) const
+        {
+            return probe( board, bitboard::Boards::fromBoard( board ).occupied, aiToMove );
+        }
+
+        // The same, for a caller that already knows which squares have pieces
+        std::optional< int8_t > probe( Piece const* board, bitboard::Bitboard occupied, bool aiToMove ) const
+        {
+            auto const found = materialOf( board, occupied );
+
+            if ( !found )
+                return std::nullopt;
+
+            auto const& [m, squares] = *found;
+
+            if ( auto const table = find( m ) )
+                return table->values[ index( m, squares, aiToMove ) ];
+
+            // the colours swapped and the board turned over
+            auto const flipped = m.flipped();
+
+            if ( auto const table = find( flipped ) )
+            {
+                Squares flippedSquares{};
+                int next = 0;
+
+                for ( bool const isAi : { true, false } )
+                {
+                    for ( int i = 0; i < m.count; ++i )
+                    {
+                        if ( m.pieces[ i ].isAi() == isAi )
+                            flippedSquares[ next++ ] = squares[ i ] ^ 56;
+                    }
+                }
+
+                return table->values[ index( flipped, flippedSquares, !aiToMove ) ];
+            }
+
+            return std::nullopt;
+        }
+
+    private:
+        struct Table
+        {
+            Material material;
+            std::span< int8_t const > values;
+        };
+
+        Table const* find( Material const& m ) const
+        {
+            for ( auto const& table : m_tables )
+            {
+                if ( table.material == m )
+                    return &table;
+            }
+
+            return nullptr;
+        }
+
+        std::vector< Table > m_tables;
+        std::vector< MappedFile > m_files;
+        int m_maxPieces = 0;
+    };
+
+    // The tables the search probes, empty unless some were loaded
+    inline Tablebases tablebases;
+}
@@ -0,0 +1,231 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#if defined( __linux__ )
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/*
+    Long-lived worker threads shared by the searches and any background work. Every worker owns a
+    deque: tasks it submits go on the back of its own deque and it pops from the back, while idle
+    workers steal from the front of the others'. Tasks from outside the pool are dealt round-robin.
+*/
+class ThreadPool
+{
+public:
+    using Task = std::move_only_function< void() >;
+
+    explicit ThreadPool( unsigned threadCount, bool pinThreads = false ):
+        m_queues( std::max( threadCount, 1u ) )
+    {
+        for ( unsigned i = 0; i < m_queues.size(); ++i )
+        {
+            m_workers.emplace_back( [this, i]{ workerLoop( i ); } );
+
+            if ( pinThreads )
+                pinToCore( m_workers.back(), i );
+        }
+    }
+
+    ThreadPool( ThreadPool const& ) = delete;
+    ThreadPool& operator=( ThreadPool const& ) = delete;
+
+    // Finishes every queued task before joining
+    ~ThreadPool()
+    {
+        {
+            auto const lock = std::scoped_lock( m_sleepMutex );
+            m_stopping = true;
+        }
+
+        m_wake.notify_all();
+
+        for ( auto& worker : m_workers )
+        {
+            worker.join();
+        }
+    }
+
+    size_t size() const { return m_workers.size(); }
+
+    template< class Fn >
+    auto submit( Fn fn ) -> std::future< std::invoke_result_t< Fn& > >
+    {
+        std::packaged_task< std::invoke_result_t< Fn& >() > task( std::move( fn ) );
+        auto future = task.get_future();
+
+        push( std::move( task ) );
+
+        return future;
+    }
+
+    // Runs fn on the pool, then passes its result to callback on the same worker
+    template< class Fn, class Callback >
+    void submit( Fn fn, Callback callback )
+    {
+        push( [fn = std::move( fn ), callback = std::move( callback )]() mutable
+        {
+            if constexpr ( std::is_void_v< std::invoke_result_t< Fn& > > )
+            {
+                fn();
+                callback();
+            }
+            else
+            {
+                callback( fn() );
+            }
+        } );
+    }
+
+    /*
+        Waits for a task submitted to this pool. A worker keeps running queued tasks while it waits,
+        so tasks waiting on their own subtasks can't deadlock the pool.
+    */
+    template< class T >
+    T wait( std::future< T >& future )
+    {
+        if ( t_pool != this )
+            return future.get();
+
+        while ( future.wait_for( std::chrono::seconds( 0 ) ) != std::future_status::ready )
+        {
+            if ( !tryRunOne( t_workerIndex ) )
+                std::this_thread::yield();
+        }
+
+        return future.get();
+    }
+
+    static void pinToCore( std::thread& thread, unsigned core )
+    {
+#if defined( __linux__ )
+        cpu_set_t set;
+        CPU_ZERO( &set );
+        CPU_SET( core % std::max( std::thread::hardware_concurrency(), 1u ), &set );
+
+        pthread_setaffinity_np( thread.native_handle(), sizeof( set ), &set );
+#else
+        // affinity is only implemented for linux
+        ( void )thread;
+        ( void )core;
+#endif
+    }
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque< Task > tasks;
+    };
+
+    void push( Task task )
+    {
+        auto const index = t_pool == this
+            ? t_workerIndex
+            : m_nextQueue.fetch_add( 1, std::memory_order_relaxed ) % m_queues.size();
+
+        {
+            auto& queue = m_queues[ index ];
+            auto const lock = std::scoped_lock( queue.mutex );
+            queue.tasks.push_back( std::move( task ) );
+        }
+
+        m_pending.fetch_add( 1 );
+
+        // taking the lock orders this with a worker checking m_pending before it sleeps
+        {
+            auto const lock = std::scoped_lock( m_sleepMutex );
+        }
+
+        m_wake.notify_one();
+    }
+
+    bool tryPop( unsigned index, Task& out )
+    {
+        auto& queue = m_queues[ index ];
+        auto const lock = std::scoped_lock( queue.mutex );
+
+        if ( queue.tasks.empty() )
+            return false;
+
+        out = std::move( queue.tasks.back() );
+        queue.tasks.pop_back();
+
+        return true;
+    }
+
+    bool trySteal( unsigned thief, Task& out )
+    {
+        for ( size_t i = 1; i < m_queues.size(); ++i )
+        {
+            auto& queue = m_queues[ ( thief + i ) % m_queues.size() ];
+            auto const lock = std::scoped_lock( queue.mutex );
+
+            if ( queue.tasks.empty() )
+                continue;
+
+            out = std::move( queue.tasks.front() );
+            queue.tasks.pop_front();
+
+            return true;
+        }
+
+        return false;
+    }
+
+    bool tryRunOne( unsigned index )
+    {
+        Task task;
+
+        if ( !tryPop( index, task ) && !trySteal( index, task ) )
+            return false;
+
+        m_pending.fetch_sub( 1 );
+
+        task();
+
+        return true;
+    }
+
+    void workerLoop( unsigned index )
+    {
+        t_pool = this;
+        t_workerIndex = index;
+
+        while ( true )
+        {
+            if ( tryRunOne( index ) )
+                continue;
+
+            auto lock = std::unique_lock( m_sleepMutex );
+
+            m_wake.wait( lock, [this]{ return m_stopping || m_pending.load() > 0; } );
+
+            if ( m_stopping && m_pending.load() == 0 )
+                return;
+        }
+    }
+
+private:
+    std::vector< Queue > m_queues;
+    std::vector< std::thread > m_workers;
+    std::atomic< unsigned > m_nextQueue = 0;
+    std::atomic< int > m_pending = 0;
+    std::mutex m_sleepMutex;
+    std::condition_variable m_wake;
+    bool m_stopping = false;
+
+    static inline thread_local ThreadPool* t_pool = nullptr;
+    static inline thread_local unsigned t_workerIndex = 0;
+};
@@ -0,0 +1,245 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include <limits>
+#include <algorithm>
+
+#include "MoveList.h"
+
+namespace tt
+{
+    enum class Bound : uint8_t
+    {
+        None  = 0,
+        Exact = 1,
+        // score is at least this (failed high)
+        Lower = 2,
+        // score is at most this (failed low)
+        Upper = 3
+    };
+
+    struct Entry
+    {
+        PackedMove move{};
+        int score = 0;
+        int depth = 0;
+        Bound bound = Bound::None;
+
+        constexpr bool hasMove() const { return !move.isNull(); }
+    };
+
+    namespace details
+    {
+        /*
+            Layout of the 64-bit data word of a slot:
+              bits  0-15  move, 0 if there is none
+              bits 16-47  score
+              bits 48-55  depth
+              bits 56-57  bound
+              bits 58-63  age
+        */
+        constexpr uint64_t pack( Entry const& e, uint8_t age )
+        {
+            uint64_t data = e.move.raw();
+
+            data |= static_cast< uint64_t >( static_cast< uint32_t >( e.score ) ) << 16;
+            data |= static_cast< uint64_t >( static_cast< uint8_t >( e.depth ) ) << 48;
+            data |= static_cast< uint64_t >( e.bound ) << 56;
+            data |= static_cast< uint64_t >( age & 63 ) << 58;
+
+            return data;
+        }
+
+        constexpr Entry unpack( uint64_t data )
+        {
+            Entry e;
+
+            e.move = PackedMove::fromRaw( static_cast< uint16_t >( data ) );
+            e.score = static_cast< int32_t >( static_cast< uint32_t >( data >> 16 ) );
+            e.depth = static_cast< uint8_t >( data >> 48 );
+            e.bound = static_cast< Bound >( ( data >> 56 ) & 3 );
+
+            return e;
+        }
+
+        constexpr uint8_t getAge( uint64_t data )
+        {
+            return static_cast< uint8_t >( data >> 58 );
+        }
+
+        constexpr int getDepth( uint64_t data )
+        {
+            return static_cast< uint8_t >( data >> 48 );
+        }
+
+        /*
+            Shared between search threads without locks. The key is stored xored with the data, so a
+            slot torn by two threads writing at once fails verification instead of returning garbage.
+        */
+        struct Slot
+        {
+            std::atomic< uint64_t > keyXorData = 0;
+            std::atomic< uint64_t > data = 0;
+
+            void clear()
+            {
+                keyXorData.store( 0, std::memory_order_relaxed );
+                data.store( 0, std::memory_order_relaxed );
+            }
+        };
+
+        constexpr size_t SlotsPerBucket = 4;
+
+        // one bucket per cache line, so a probe touches a single line
+        struct alignas( 64 ) Bucket
+        {
+            std::array< Slot, SlotsPerBucket > slots;
+        };
+
+        static_assert( sizeof( Bucket ) == 64 );
+        static_assert( std::atomic< uint64_t >::is_always_lock_free );
+    }
+
+    /*
+        Fixed-size hash table of search results keyed by zobrist key. Entries from older searches
+        are replaced first, then the shallowest ones. Safe to probe and store from several threads.
+    */
+    class TranspositionTable
+    {
+    public:
+        static constexpr size_t DefaultSizeMB = 16;
+
+        explicit TranspositionTable( size_t sizeMB = DefaultSizeMB )
+        {
+            resize( sizeMB );
+        }
+
+        void resize( size_t sizeMB )
+        {
+            auto const bytes = std::max< size_t >( sizeMB, 1 ) * 1024 * 1024;
+
+            // keep the bucket count a power of two so the index is a mask
+            size_t count = 1;
+            while ( count * 2 * sizeof( details::Bucket ) <= bytes )
+                count *= 2;
+
+            m_buckets = std::make_unique< details::Bucket[] >( count );
+            m_count = count;
+        }
+
+        // Not safe while a search is running
+        void clear()
+        {
+            for ( size_t i = 0; i < m_count; ++i )
+            {
+                for ( auto& slot : m_buckets[ i ].slots )
+                {
+                    slot.clear();
+                }
+            }
+
+            m_age = 0;
+        }
+
+        // Called once per search, so entries from previous searches become preferred victims
+        void newSearch()
+        {
+            m_age = ( m_age + 1 ) & 63;
+        }
+
+        size_t sizeMB() const
+        {
+            return m_count * sizeof( details::Bucket ) / ( 1024 * 1024 );
+        }
+
+        void prefetch( uint64_t key ) const
+        {
+#if defined( __GNUC__ )
+            __builtin_prefetch( &bucketFor( key ) );
+#endif
+        }
+
+        bool probe( uint64_t key, Entry& out ) const
+        {
+            for ( auto const& slot : bucketFor( key ).slots )
+            {
+                auto const data = slot.data.load( std::memory_order_relaxed );
+                auto const keyXorData = slot.keyXorData.load( std::memory_order_relaxed );
+
+                if ( data != 0 && ( keyXorData ^ data ) == key )
+                {
+                    out = details::unpack( data );
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        void store( uint64_t key, Entry const& e )
+        {
+            auto& bucket = bucketFor( key );
+
+            details::Slot* victim = &bucket.slots[ 0 ];
+            uint64_t victimData = 0;
+            int victimWorth = std::numeric_limits< int >::max();
+
+            for ( auto& slot : bucket.slots )
+            {
+                auto const data = slot.data.load( std::memory_order_relaxed );
+                auto const keyXorData = slot.keyXorData.load( std::memory_order_relaxed );
+
+                if ( data == 0 || ( keyXorData ^ data ) == key )
+                {
+                    victim = &slot;
+                    victimData = data;
+                    break;
+                }
+
+                // an entry loses 8 plies of worth for every search it has been left untouched
+                auto const age = ( m_age - details::getAge( data ) ) & 63;
+                auto const worth = details::getDepth( data ) - 8 * age;
+
+                if ( worth < victimWorth )
+                {
+                    victim = &slot;
+                    victimWorth = worth;
+                    victimData = 0;
+                }
+            }
+
+            auto entry = e;
+
+            // don't lose the best move of a position when storing a result without one
+            if ( !entry.hasMove() && victimData != 0 )
+            {
+                entry.move = details::unpack( victimData ).move;
+            }
+
+            auto const data = details::pack( entry, m_age );
+
+            victim->keyXorData.store( key ^ data, std::memory_order_relaxed );
+            victim->data.store( data, std::memory_order_relaxed );
+        }
+
+    private:
+        details::Bucket& bucketFor( uint64_t key )
+        {
+            return m_buckets[ key & ( m_count - 1 ) ];
+        }
+
+        details::Bucket const& bucketFor( uint64_t key ) const
+        {
+            return m_buckets[ key & ( m_count - 1 ) ];
+        }
+
+    private:
+        std::unique_ptr< details::Bucket[] > m_buckets;
+        size_t m_count = 0;
+        uint8_t m_age = 0;
+    };
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "Piece.h"
+
+namespace zobrist
+{
+    namespace details
+    {
+        // splitmix64, so the keys are the same every build and can be generated at compile time
+        constexpr uint64_t nextRandom( uint64_t& state )
+        {
+            state += 0x9E3779B97F4A7C15ull;
+
+            auto z = state;
+            z = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ull;
+            z = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBull;
+
+            return z ^ ( z >> 31 );
+        }
+
+        // one set of 64 square keys per piece type and colour
+        using PieceKeys = std::array< std::array< uint64_t, 64 >, 12 >;
+
+        consteval PieceKeys makePieceKeys()
+        {
+            PieceKeys keys{};
+            uint64_t state = 0x2545F4914F6CDD1Dull;
+
+            for ( auto& squares : keys )
+            {
+                for ( auto& key : squares )
+                {
+                    key = nextRandom( state );
+                }
+            }
+
+            return keys;
+        }
+
+        constexpr PieceKeys PieceSquareKeys = makePieceKeys();
+
+        // one per castling right, then one per file an en passant capture can land on
+        consteval std::array< uint64_t, 12 > makeStateKeys()
+        {
+            std::array< uint64_t, 12 > keys{};
+            uint64_t state = 0x9C6D5E3F1A2B4C87ull;
+
+            for ( auto& key : keys )
+            {
+                key = nextRandom( state );
+            }
+
+            return keys;
+        }
+
+        constexpr auto StateKeys = makeStateKeys();
+    }
+
+    constexpr uint64_t AiToMove = 0xF3A1C5E7B9D20486ull;
+
+    // Null pieces hash to 0, so callers can xor in the piece at a square without checking it
+    constexpr uint64_t pieceKey( Piece piece, int16_t index )
+    {
+        if ( piece.isNull() )
+            return 0;
+
+        auto const pieceIndex = static_cast< uint8_t >( piece.type ) + ( piece.isBlack ? 6 : 0 );
+
+        return details::PieceSquareKeys[ pieceIndex ][ index ];
+    }
+
+    // The xor of the keys of each right held, a bit each as in board::castling
+    constexpr uint64_t castlingKey( uint8_t rights )
+    {
+        uint64_t key = 0;
+
+        for ( int right = 0; right < 4; ++right )
+        {
+            if ( rights & ( 1 << right ) )
+                key ^= details::StateKeys[ right ];
+        }
+
+        return key;
+    }
+
+    // Keyed by file. No square, -1, hashes to 0
+    constexpr uint64_t enPassantKey( int16_t square )
+    {
+        return square < 0 ? 0 : details::StateKeys[ 4 + square % 8 ];
+    }
+
+    // The pieces and side to move; positions add the keys of their castling rights and en passant square
+    constexpr uint64_t hash( Piece const* board, bool aiToMove )
+    {
+        uint64_t key = aiToMove ? AiToMove : 0;
+
+        for ( int16_t i = 0; i < 64; ++i )
+        {
+            key ^= pieceKey( board[ i ], i );
+        }
+
+        return key;
+    }
+}
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
+#include <tuple>
 
 #include "Piece.h"
 #include "Vec2.h"
@@ -23,57 +25,138 @@ namespace board
         return { Coord( x / ( window::Width / 8 ) ), Coord( y / ( window::Height / 8 ) ) };
     }
 
-    // Moves the piece at "from" to "dst". Returns the piece originally at "from", the piece that originally at "dst", and whether there was a promotion to queen
-    constexpr std::tuple< Piece, Piece, bool > movePiece( Piece* board, int16_t fromIdx, int16_t dstIdx )
+    /*
+        Castling moves the king two squares towards one of its rooks, and the rook to the square the
+        king crossed. A side may castle with a rook until its king or that rook moves or the rook is
+        taken, so the rights are a bit per side and rook.
+    */
+    namespace castling
     {
-        auto const pieceAtDst = board[ dstIdx ];
-        auto const pieceAtFrom = board[ fromIdx ];
-
-        board[ dstIdx ] = board[ fromIdx ];
-        board[ fromIdx ] = Piece{};
+        struct Castle
+        {
+            uint8_t right;
+            int16_t kingFrom;
+            int16_t kingDst;
+            int16_t rookFrom;
+            int16_t rookDst;
+        };
+
+        // The user's castles then the ai's, each towards the right of the board then the left
+        inline constexpr std::array< Castle, 4 > Castles = { {
+            { 1, 60, 62, 63, 61 },
+            { 2, 60, 58, 56, 59 },
+            { 4,  4,  6,  7,  5 },
+            { 8,  4,  2,  0,  3 },
+        } };
+
+        constexpr uint8_t AllRights = 15;
+
+        // The castle a king of the side moving from fromIdx to dstIdx makes, or nullptr for an ordinary move
+        constexpr Castle const* find( Piece king, int16_t fromIdx, int16_t dstIdx )
+        {
+            if ( king.type != piece::Type::King )
+                return nullptr;
 
-        auto const atTopOrBottom = ( 0 <= dstIdx && dstIdx < 8 ) || ( 56 <= dstIdx && dstIdx < 64 );
+            for ( auto i = king.isAi() * 2; i < king.isAi() * 2 + 2; ++i )
+            {
+                if ( Castles[ i ].kingFrom == fromIdx && Castles[ i ].kingDst == dstIdx )
+                    return &Castles[ i ];
+            }
 
-        auto const promoteToQueen = atTopOrBottom && board[ dstIdx ].type == piece::Type::Pawn;
+            return nullptr;
+        }
 
-        if ( promoteToQueen )
+        namespace details
         {
-            board[ dstIdx ].type = piece::Type::Queen;
+            consteval std::array< uint8_t, 64 > makeKeptRights()
+            {
+                std::array< uint8_t, 64 > kept;
+                kept.fill( AllRights );
+
+                for ( auto const& c : Castles )
+                {
+                    kept[ c.kingFrom ] &= ~c.right;
+                    kept[ c.rookFrom ] &= ~c.right;
+                }
+
+                return kept;
+            }
         }
 
-        return { pieceAtFrom, pieceAtDst, promoteToQueen };
+        // The rights left after a move from or to each square, which lose those of a king or rook starting there
+        inline constexpr auto KeptRights = details::makeKeptRights();
+    }
+
+    // A pawn stepping diagonally onto an empty square can only be taking en passant
+    constexpr bool isEnPassant( Piece const* board, int16_t fromIdx, int16_t dstIdx )
+    {
+        return board[ fromIdx ].type == piece::Type::Pawn && board[ dstIdx ].isNull() && fromIdx % 8 != dstIdx % 8;
+    }
+
+    // The pawn taken en passant is beside the one taking it, behind the square that one moves to
+    constexpr int16_t enPassantVictim( int16_t fromIdx, int16_t dstIdx )
+    {
+        return static_cast< int16_t >( fromIdx / 8 * 8 + dstIdx % 8 );
     }
 
-    constexpr bool hasPiece( Piece* board, Piece piece )
+    constexpr bool isPromotion( Piece const* board, int16_t fromIdx, int16_t dstIdx )
     {
-        for ( int i = 0; i < 64; ++i )
+        auto const atTopOrBottom = ( 0 <= dstIdx && dstIdx < 8 ) || ( 56 <= dstIdx && dstIdx < 64 );
+
+        return atTopOrBottom && board[ fromIdx ].type == piece::Type::Pawn;
+    }
+
+    /*
+        Moves the piece at "from" to "dst", a pawn reaching the last row becoming promotion. A king
+        moving two squares castles, taking its rook along, and a pawn stepping diagonally onto an
+        empty square takes en passant. Returns the piece originally at "from", the piece originally at
+        "dst", and whether there was a promotion
+    */
+    constexpr std::tuple< Piece, Piece, bool > movePiece( Piece* board, int16_t fromIdx, int16_t dstIdx, piece::Type promotion = piece::Type::Queen )
+    {
+        auto const pieceAtDst = board[ dstIdx ];
+        auto const pieceAtFrom = board[ fromIdx ];
+        auto const promote = isPromotion( board, fromIdx, dstIdx );
+
+        if ( auto const castle = castling::find( pieceAtFrom, fromIdx, dstIdx ) )
         {
-            if ( board[ i ] == piece )
-            {
-                return true;
-            }
+            board[ castle->rookDst ] = board[ castle->rookFrom ];
+            board[ castle->rookFrom ] = Piece{};
+        }
+        else if ( isEnPassant( board, fromIdx, dstIdx ) )
+        {
+            board[ enPassantVictim( fromIdx, dstIdx ) ] = Piece{};
+        }
+
+        board[ dstIdx ] = board[ fromIdx ];
+        board[ fromIdx ] = Piece{};
+
+        if ( promote )
+        {
+            board[ dstIdx ].type = promotion;
         }
 
-        return false;
+        return { pieceAtFrom, pieceAtDst, promote };
     }
 
-    // Moves the piece at "from" to "dst". Returns the piece originally at "from", the piece that originally at "dst", and whether there was a promotion to queen
-    constexpr std::tuple< Piece, Piece, bool > movePiece( Piece* board, Vec2 from, Vec2 dst )
+    // The same with coordinates
+    constexpr std::tuple< Piece, Piece, bool > movePiece( Piece* board, Vec2 from, Vec2 dst, piece::Type promotion = piece::Type::Queen )
     {
         auto const fromIndex = coordsToIndex( from );
         auto const dstIndex  = coordsToIndex( dst );
 
-        return movePiece( board, fromIndex, dstIndex );
+        return movePiece( board, fromIndex, dstIndex, promotion );
     }
 
-    constexpr bool isPawnStartingPosition( int16_t index )
+    // The ai's pawns start on the second row from the top, the user's on the second from the bottom
+    constexpr bool isPawnStartingPosition( int16_t index, bool isAi )
     {
-        return ( 8 <= index && index < 16 ) || ( 48 <= index && index < 56 );
+        return isAi ? ( 8 <= index && index < 16 ) : ( 48 <= index && index < 56 );
     }
 
-    constexpr bool isPawnStartingPosition( Vec2 coords )
+    constexpr bool isPawnStartingPosition( Vec2 coords, bool isAi )
     {
-        return isPawnStartingPosition( coordsToIndex( coords ) );
+        return isPawnStartingPosition( coordsToIndex( coords ), isAi );
     }
 
     constexpr bool isOutOfBounds( Vec2 coords )
@@ -104,8 +187,8 @@ namespace board
                 board[ 0 ] = White( Rook );
                 board[ 1 ] = White( Knight );
                 board[ 2 ] = White( Bishop );
-                board[ 3 ] = White( King );
-                board[ 4 ] = White( Queen );
+                board[ 3 ] = White( Queen );
+                board[ 4 ] = White( King );
                 board[ 5 ] = White( Bishop );
                 board[ 6 ] = White( Knight );
                 board[ 7 ] = White( Rook );
@@ -1,13 +1,149 @@
+#include <charconv>
 #include <iostream>
+#include <string_view>
+#include <cstdlib>
 
 #include <raylib.h>
 
 #include "Game.h"
 #include "Input.h"
+#include "Bench.h"
 
+namespace
+{
+    // The positive number after argument i, which is then skipped, or fallback if the next argument isn't one
+    int optionalCount( int argc, char** argv, int& i, int fallback )
+    {
+        if ( i + 1 >= argc )
+            return fallback;
+
+        auto const arg = std::string_view( argv[ i + 1 ] );
+        int value = 0;
+        auto const [end, error] = std::from_chars( arg.data(), arg.data() + arg.size(), value );
+
+        if ( error != std::errc{} || end != arg.data() + arg.size() || value <= 0 )
+            return fallback;
 
-int main( int, char** )
+        i += 1;
+
+        return value;
+    }
+}
+
+int main( int argc, char** argv )
 {
+    Game game;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        auto const arg = std::string_view( argv[ i ] );
+
+        if ( arg == "--compare-minimax" )
+        {
+            ai::compareWithMiniMax = true;
+        }
+        else if ( arg == "--movetime" && i + 1 < argc )
+        {
+            game.ai.limits = { std::atof( argv[ ++i ] ) };
+        }
+        else if ( arg == "--hash" && i + 1 < argc )
+        {
+            ai::transpositionTable.resize( std::strtoull( argv[ ++i ], nullptr, 10 ) );
+        }
+        else if ( arg == "--threads" && i + 1 < argc )
+        {
+            ai::threadCount = std::max( 1, std::atoi( argv[ ++i ] ) );
+        }
+        else if ( arg == "--pin-threads" )
+        {
+            ai::pinThreads = true;
+        }
+        else if ( arg == "--no-ponder" )
+        {
+            ai::ponder = false;
+        }
+        else if ( arg == "--stats" )
+        {
+            ai::printStats = true;
+        }
+        else if ( arg == "--book" && i + 1 < argc )
+        {
+            if ( !book::openingBook.open( argv[ ++i ] ) )
+            {
+                std::cerr << argv[ i ] << " isn't an opening book\n";
+                return 1;
+            }
+
+            std::cout << "Opened a book of " << book::openingBook.size() << " moves\n";
+        }
+        else if ( arg == "--tb" && i + 1 < argc )
+        {
+            std::cout << "Loaded " << tablebase::tablebases.load( argv[ ++i ] ) << " endgame tables\n";
+        }
+        else if ( arg == "--nnue" && i + 1 < argc )
+        {
+            nnue::network = nnue::Network::load( argv[ ++i ] );
+
+            if ( !nnue::network )
+                return 1;
+        }
+        else if ( arg == "--bench-smp" )
+        {
+            auto const depth = optionalCount( argc, argv, i, 7 );
+            auto const maxThreads = optionalCount( argc, argv, i, 0 );
+
+            bench::smpScaling( depth, maxThreads );
+            return 0;
+        }
+        else if ( arg == "--no-null-move" )
+        {
+            ai::pruning.nullMove = false;
+        }
+        else if ( arg == "--no-lmr" )
+        {
+            ai::pruning.lateMoveReductions = false;
+        }
+        else if ( arg == "--no-futility" )
+        {
+            ai::pruning.futility = false;
+        }
+        else if ( arg == "--no-razoring" )
+        {
+            ai::pruning.razoring = false;
+        }
+        else if ( arg == "--bench-pruning" )
+        {
+            bench::selectivePruning( optionalCount( argc, argv, i, 6 ) );
+            return 0;
+        }
+        else if ( arg == "--bench-movegen" )
+        {
+            bench::stagedMoveGeneration( optionalCount( argc, argv, i, 6 ) );
+            return 0;
+        }
+        else if ( arg == "--bench-perft" )
+        {
+            return bench::perft( optionalCount( argc, argv, i, 4 ) ) ? 0 : 1;
+        }
+        else if ( arg == "--bench-nnue" )
+        {
+            // a following flag isn't a network file
+            auto const path = i + 1 < argc && !std::string_view( argv[ i + 1 ] ).starts_with( "--" ) ? argv[ ++i ] : nullptr;
+
+            return bench::nnueEvaluation( path ) ? 0 : 1;
+        }
+        else if ( arg == "--bench-cancel" )
+        {
+            bench::cancellation( optionalCount( argc, argv, i, ai::threadCount ) );
+            return 0;
+        }
+        else if ( arg == "--bench-ordering" )
+        {
+            bench::orderingHeuristics( optionalCount( argc, argv, i, 6 ) );
+            return 0;
+        }
+    }
+
     InitWindow( window::Width, window::Height, window::Title );
 
     SetWindowMaxSize( window::Width, window::Height );
@@ -17,8 +153,6 @@ int main( int, char** )
     
     auto pieces = LoadTexture( "../img/pieces.png" );
 
-    Game game;
-
     while ( !WindowShouldClose() )
     {
         processInput( game );
@@ -39,6 +173,9 @@ int main( int, char** )
         EndDrawing();
     }
 
+    // the ai is usually pondering when the player quits, and that search has to stop while raylib is still up
+    game.cancelSearches();
+
     UnloadTexture( pieces );
     CloseWindow();
 
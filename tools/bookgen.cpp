@@ -0,0 +1,479 @@
+/*
+    Builds an opening book for the engine from PGN files.
+
+        bookgen [--plies N] [--min-games N] [--threads N] <output file> <pgn files...>
+
+    The files are read a block at a time and their games parsed on every core, so they can be much
+    larger than memory. White is the user and black the ai. The first N plies (20 by default) of each
+    game are replayed on the engine's position; a game stops counting at the first move that isn't
+    legal there, which only a broken PGN has. Moves played in fewer than --min-games games (2 by
+    default) are left out.
+*/
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "AI.h"
+#include "OpeningBook.h"
+
+namespace
+{
+    struct Options
+    {
+        int plies = 20;
+        uint32_t minGames = 2;
+        int threads = static_cast< int >( std::max( 1u, std::thread::hardware_concurrency() ) );
+    };
+
+    // How often a move was played from a position and how it scored
+    struct MoveStats
+    {
+        uint64_t weight = 0;
+        uint64_t games = 0;
+    };
+
+    struct BookKey
+    {
+        uint64_t position;
+        uint16_t move;
+
+        bool operator==( BookKey const& ) const = default;
+    };
+
+    struct BookKeyHash
+    {
+        size_t operator()( BookKey const& k ) const
+        {
+            return k.position ^ ( static_cast< uint64_t >( k.move ) * 0x9E3779B97F4A7C15ull );
+        }
+    };
+
+    using Counts = std::unordered_map< BookKey, MoveStats, BookKeyHash >;
+
+    // Square names are from white's side: a1 is the user's bottom left corner
+    std::optional< int16_t > parseSquare( std::string_view s )
+    {
+        if ( s.size() != 2 || s[ 0 ] < 'a' || s[ 0 ] > 'h' || s[ 1 ] < '1' || s[ 1 ] > '8' )
+            return std::nullopt;
+
+        return static_cast< int16_t >( ( '8' - s[ 1 ] ) * 8 + ( s[ 0 ] - 'a' ) );
+    }
+
+    // The move a SAN token means in pos, if it's legal there
+    std::optional< PackedMove > parseSan( std::string_view san, Position& pos )
+    {
+        while ( !san.empty() && std::string_view( "+#!?" ).find( san.back() ) != std::string_view::npos )
+        {
+            san.remove_suffix( 1 );
+        }
+
+        if ( san.empty() )
+            return std::nullopt;
+
+        MoveList moves;
+        ai::details::generateMoves( pos, moves );
+
+        // castling is written as the king's move, from its square to two files over
+        if ( san == "O-O" || san == "0-0" || san == "O-O-O" || san == "0-0-0" )
+        {
+            auto const king = pos.kings[ pos.aiToMove ];
+            auto const dst = king + ( san.size() == 3 ? 2 : -2 );
+
+            auto const castle = std::find_if( moves.begin(), moves.end(), [&pos, king, dst]( OrderedMove const& m )
+            {
+                return m.move.from() == king && m.move.dst() == dst && board::castling::find( pos.board[ king ], king, dst );
+            } );
+
+            return castle == moves.end() ? std::nullopt : std::optional( castle->move );
+        }
+
+        auto promotion = piece::Type::Null;
+
+        if ( auto const equals = san.find( '=' ); equals != std::string_view::npos )
+        {
+            auto const letter = san.size() == equals + 2 ? std::string_view( "QBNR" ).find( san[ equals + 1 ] ) : std::string_view::npos;
+
+            if ( letter == std::string_view::npos )
+                return std::nullopt;
+
+            promotion = static_cast< piece::Type >( letter + 1 );
+            san = san.substr( 0, equals );
+        }
+
+        auto type = piece::Type::Pawn;
+
+        if ( auto const letter = std::string_view( "KQBNR" ).find( san[ 0 ] ); letter != std::string_view::npos )
+        {
+            type = static_cast< piece::Type >( letter );
+            san.remove_prefix( 1 );
+        }
+
+        if ( san.size() < 2 )
+            return std::nullopt;
+
+        auto const dst = parseSquare( san.substr( san.size() - 2 ) );
+
+        if ( !dst )
+            return std::nullopt;
+
+        // whatever is left says which file or rank the piece came from
+        int fromFile = -1;
+        int fromRank = -1;
+
+        for ( auto const c : san.substr( 0, san.size() - 2 ) )
+        {
+            if ( 'a' <= c && c <= 'h' )
+                fromFile = c - 'a';
+            else if ( '1' <= c && c <= '8' )
+                fromRank = '8' - c;
+            else if ( c != 'x' )
+                return std::nullopt;
+        }
+
+        std::optional< PackedMove > found;
+
+        // the moves are legal ones, so SAN leaving out what only a move into check could be confused with is fine
+        for ( auto const& [m, _] : moves )
+        {
+            if ( m.dst() != *dst || pos.board[ m.from() ].type != type || m.promotion() != promotion
+              || ( fromFile >= 0 && m.from() % 8 != fromFile ) || ( fromRank >= 0 && m.from() / 8 != fromRank ) )
+                continue;
+
+            // two legal moves fit, so the PGN is wrong
+            if ( found )
+                return std::nullopt;
+
+            found = m;
+        }
+
+        return found;
+    }
+
+    // Removes comments and variations from movetext, leaving a space in their place
+    std::string stripMovetext( std::string_view text )
+    {
+        std::string out;
+        int variationDepth = 0;
+        bool inComment = false;
+
+        for ( size_t i = 0; i < text.size(); ++i )
+        {
+            auto const c = text[ i ];
+
+            if ( inComment )
+            {
+                inComment = c != '}';
+                continue;
+            }
+
+            if ( c == '{' )
+                inComment = true;
+            else if ( c == '(' )
+                variationDepth += 1;
+            else if ( c == ')' )
+                variationDepth = std::max( 0, variationDepth - 1 );
+            else if ( c == ';' )
+                i = std::min( text.find( '\n', i ), text.size() );
+            else if ( variationDepth == 0 )
+            {
+                out += c;
+                continue;
+            }
+
+            out += ' ';
+        }
+
+        return out;
+    }
+
+    // Adds the opening of one game, tags and movetext, to counts
+    void addGame( std::string_view game, Options const& options, Counts& counts )
+    {
+        // 2 if white won, 0 if black did, 1 for a draw
+        int whiteScore = -1;
+
+        if ( auto const tag = game.find( "[Result \"" ); tag != std::string_view::npos )
+        {
+            auto const result = game.substr( tag + 9, 3 );
+            whiteScore = result == "1-0" ? 2 : result == "0-1" ? 0 : result == "1/2" ? 1 : -1;
+        }
+
+        // unfinished games say nothing about which moves are good
+        if ( whiteScore < 0 )
+            return;
+
+        // the movetext starts after the last tag
+        auto const lastTag = game.rfind( "]\n" );
+        auto const movetext = stripMovetext( game.substr( lastTag == std::string_view::npos ? 0 : lastTag + 2 ) );
+
+        auto position = Position::startPosition();
+        int ply = 0;
+
+        size_t pos = 0;
+
+        while ( ply < options.plies && pos < movetext.size() )
+        {
+            auto const begin = movetext.find_first_not_of( " \t\r\n", pos );
+
+            if ( begin == std::string::npos )
+                break;
+
+            auto const end = std::min( movetext.find_first_of( " \t\r\n", begin ), movetext.size() );
+            auto token = std::string_view( movetext ).substr( begin, end - begin );
+            pos = end;
+
+            // move numbers, possibly stuck to the move: "12." "12..." "12.e4"
+            auto const digits = token.find_first_not_of( "0123456789" );
+
+            if ( digits != std::string_view::npos && digits > 0 && token[ digits ] == '.' )
+                token.remove_prefix( std::min( token.find_first_not_of( '.', digits ), token.size() ) );
+
+            if ( token.empty() || token[ 0 ] == '$' )
+                continue;
+
+            if ( token == "1-0" || token == "0-1" || token == "1/2-1/2" || token == "*" )
+                break;
+
+            auto const move = parseSan( token, position );
+
+            if ( !move )
+                break;
+
+            auto& stats = counts[ { position.key, move->raw() } ];
+            stats.games += 1;
+            stats.weight += position.aiToMove ? 2 - whiteScore : whiteScore;
+
+            board::movePiece( position, move->from(), move->dst(), move->promotion() );
+            ply += 1;
+        }
+    }
+
+    // Blocks of whole games handed from the reader to the parsers, a few at a time so memory stays bounded
+    class BlockQueue
+    {
+    public:
+        explicit BlockQueue( size_t capacity ):
+            m_capacity( capacity ) {}
+
+        void push( std::string block )
+        {
+            std::unique_lock lock( m_mutex );
+            m_notFull.wait( lock, [this] { return m_blocks.size() < m_capacity; } );
+            m_blocks.push_back( std::move( block ) );
+            m_notEmpty.notify_one();
+        }
+
+        // Empty once close has been called and every block is taken
+        std::optional< std::string > pop()
+        {
+            std::unique_lock lock( m_mutex );
+            m_notEmpty.wait( lock, [this] { return !m_blocks.empty() || m_closed; } );
+
+            if ( m_blocks.empty() )
+                return std::nullopt;
+
+            auto block = std::move( m_blocks.front() );
+            m_blocks.pop_front();
+            m_notFull.notify_one();
+
+            return block;
+        }
+
+        void close()
+        {
+            std::lock_guard lock( m_mutex );
+            m_closed = true;
+            m_notEmpty.notify_all();
+        }
+
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_notEmpty;
+        std::condition_variable m_notFull;
+        std::deque< std::string > m_blocks;
+        size_t m_capacity;
+        bool m_closed = false;
+    };
+
+    void parseBlock( std::string_view block, Options const& options, Counts& counts )
+    {
+        size_t start = block.find( "[Event " );
+
+        while ( start != std::string_view::npos )
+        {
+            auto const next = block.find( "\n[Event ", start + 1 );
+            auto const end = next == std::string_view::npos ? block.size() : next + 1;
+
+            addGame( block.substr( start, end - start ), options, counts );
+
+            start = next == std::string_view::npos ? next : next + 1;
+        }
+    }
+
+    // Reads each file a block at a time, cutting blocks where a game starts
+    bool readGames( std::vector< std::string_view > const& paths, BlockQueue& queue )
+    {
+        constexpr size_t BlockSize = 4 << 20;
+
+        for ( auto const path : paths )
+        {
+            std::ifstream in( std::string( path ), std::ios::binary );
+
+            if ( !in )
+            {
+                std::cerr << "Can't open " << path << "\n";
+                return false;
+            }
+
+            std::string pending;
+            std::string chunk( BlockSize, '\0' );
+
+            while ( in )
+            {
+                in.read( chunk.data(), static_cast< std::streamsize >( chunk.size() ) );
+                pending.append( chunk.data(), static_cast< size_t >( in.gcount() ) );
+
+                auto const cut = pending.rfind( "\n[Event " );
+
+                if ( cut == std::string::npos || cut == 0 )
+                    continue;
+
+                queue.push( pending.substr( 0, cut + 1 ) );
+                pending.erase( 0, cut + 1 );
+            }
+
+            if ( !pending.empty() )
+                queue.push( std::move( pending ) );
+        }
+
+        return true;
+    }
+
+    bool writeBook( std::string_view path, Counts const& counts, Options const& options )
+    {
+        std::vector< std::pair< BookKey, MoveStats > > kept;
+
+        for ( auto const& entry : counts )
+        {
+            if ( entry.second.games >= options.minGames )
+                kept.push_back( entry );
+        }
+
+        // by position, and each position's moves best first
+        std::sort( kept.begin(), kept.end(), []( auto const& a, auto const& b )
+        {
+            return a.first.position != b.first.position ? a.first.position < b.first.position : a.second.weight > b.second.weight;
+        } );
+
+        std::vector< book::Entry > entries;
+        entries.reserve( kept.size() );
+
+        // scaled per position so its best move, which comes first, still fits in 16 bits
+        uint64_t scale = UINT16_MAX;
+
+        for ( size_t i = 0; i < kept.size(); ++i )
+        {
+            auto const& [key, stats] = kept[ i ];
+
+            if ( i == 0 || kept[ i - 1 ].first.position != key.position )
+                scale = std::max< uint64_t >( stats.weight, UINT16_MAX );
+
+            entries.push_back( { key.position, key.move,
+                                 static_cast< uint16_t >( stats.weight * UINT16_MAX / scale ),
+                                 static_cast< uint32_t >( std::min< uint64_t >( stats.games, UINT32_MAX ) ) } );
+        }
+
+        book::Header header{};
+        std::copy( std::begin( book::Magic ), std::end( book::Magic ), header.magic );
+        header.entryCount = entries.size();
+
+        std::ofstream out( std::string( path ), std::ios::binary );
+        out.write( reinterpret_cast< const char* >( &header ), sizeof( header ) );
+        out.write( reinterpret_cast< const char* >( entries.data() ), static_cast< std::streamsize >( entries.size() * sizeof( book::Entry ) ) );
+
+        if ( !out )
+        {
+            std::cerr << "Couldn't write " << path << "\n";
+            return false;
+        }
+
+        std::cout << "Wrote " << entries.size() << " moves to " << path << "\n";
+
+        return true;
+    }
+}
+
+int main( int argc, char** argv )
+{
+    Options options;
+    std::vector< std::string_view > args;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        auto const arg = std::string_view( argv[ i ] );
+
+        if ( arg == "--plies" && i + 1 < argc )
+            options.plies = std::max( 1, std::atoi( argv[ ++i ] ) );
+        else if ( arg == "--min-games" && i + 1 < argc )
+            options.minGames = static_cast< uint32_t >( std::max( 1, std::atoi( argv[ ++i ] ) ) );
+        else if ( arg == "--threads" && i + 1 < argc )
+            options.threads = std::max( 1, std::atoi( argv[ ++i ] ) );
+        else
+            args.push_back( arg );
+    }
+
+    if ( args.size() < 2 )
+    {
+        std::cerr << "usage: bookgen [--plies N] [--min-games N] [--threads N] <output file> <pgn files...>\n";
+        return 1;
+    }
+
+    BlockQueue queue( 2 * options.threads );
+    std::vector< Counts > counts( options.threads );
+
+    {
+        std::vector< std::jthread > parsers;
+
+        for ( int t = 0; t < options.threads; ++t )
+        {
+            parsers.emplace_back( [&queue, &options, &out = counts[ t ]]
+            {
+                while ( auto const block = queue.pop() )
+                {
+                    parseBlock( *block, options, out );
+                }
+            } );
+        }
+
+        auto const ok = readGames( { args.begin() + 1, args.end() }, queue );
+
+        queue.close();
+
+        if ( !ok )
+            return 1;
+    }
+
+    // fold every parser's counts into the first
+    for ( size_t t = 1; t < counts.size(); ++t )
+    {
+        for ( auto const& [key, stats] : counts[ t ] )
+        {
+            auto& total = counts[ 0 ][ key ];
+            total.weight += stats.weight;
+            total.games += stats.games;
+        }
+    }
+
+    return writeBook( args[ 0 ], counts[ 0 ], options ) ? 0 : 1;
+}
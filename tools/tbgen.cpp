@@ -0,0 +1,621 @@
+/*
+    Generates endgame tables for the engine by retrograde analysis.
+
+        tbgen [--threads N] <output directory> [tables...]
+
+    Tables are named like "KQvK", the user's pieces then the ai's (see src/Tablebase.h). Every table
+    a requested one can turn into by a capture or a promotion is generated first, and written too.
+    Without any names it generates KQvK, KRvK, KPvK and KBNvK.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "AI.h"
+#include "Tablebase.h"
+
+namespace
+{
+    using tablebase::Material;
+    using tablebase::Squares;
+
+    // Plies to mate have to fit in an int8
+    constexpr int MaxPlies = 127;
+
+    // Calls fn( begin, end, thread ) on a slice of [0, count) from each thread
+    template< class Fn >
+    void parallelFor( uint64_t count, int threads, Fn fn )
+    {
+        std::vector< std::jthread > workers;
+
+        for ( int t = 0; t < threads; ++t )
+        {
+            workers.emplace_back( [=, &fn]
+            {
+                fn( count * t / threads, count * ( t + 1 ) / threads, t );
+            } );
+        }
+    }
+
+    // Keeps Material order after a piece has been changed or removed
+    Material sorted( Material m )
+    {
+        std::stable_sort( m.pieces.begin(), m.pieces.begin() + m.count, []( Piece a, Piece b )
+        {
+            return Material::key( a ) < Material::key( b );
+        } );
+
+        return m;
+    }
+
+    // The tables a capture or a promotion leads to
+    std::vector< Material > conversions( Material const& m )
+    {
+        std::vector< Material > result;
+
+        auto const without = []( Material m, int i )
+        {
+            std::copy( m.pieces.begin() + i + 1, m.pieces.begin() + m.count, m.pieces.begin() + i );
+            m.count -= 1;
+            return m;
+        };
+
+        for ( int i = 0; i < m.count; ++i )
+        {
+            auto const p = m.pieces[ i ];
+
+            if ( p.type != piece::Type::King )
+                result.push_back( without( m, i ) );
+
+            if ( p.type != piece::Type::Pawn )
+                continue;
+
+            for ( auto const type : ai::details::Promotions )
+            {
+                auto promoted = m;
+                promoted.pieces[ i ].type = type;
+                result.push_back( sorted( promoted ) );
+
+                // promoting with a capture
+                for ( int j = 0; j < m.count; ++j )
+                {
+                    if ( m.pieces[ j ].isAi() != p.isAi() && m.pieces[ j ].type != piece::Type::King )
+                        result.push_back( sorted( without( promoted, j ) ) );
+                }
+            }
+        }
+
+        return result;
+    }
+
+    class Generator
+    {
+    public:
+        Generator( std::filesystem::path directory, int threads ):
+            m_directory( std::move( directory ) ),
+            m_threads( threads ) {}
+
+        // Generates m after everything it converts into, unless it or its mirror image has been already
+        bool generate( Material const& m )
+        {
+            if ( isDone( m ) || isDone( m.flipped() ) )
+                return true;
+
+            for ( auto const& c : conversions( m ) )
+            {
+                if ( !generate( c ) )
+                    return false;
+            }
+
+            return build( m );
+        }
+
+    private:
+        bool isDone( Material const& m ) const
+        {
+            return std::find( m_done.begin(), m_done.end(), m ) != m_done.end();
+        }
+
+        struct Placement
+        {
+            Squares squares{};
+            bool aiToMove = false;
+        };
+
+        static Placement decode( Material const& m, uint64_t idx )
+        {
+            Placement p;
+            p.aiToMove = idx >= m.placements();
+            idx %= m.placements();
+
+            for ( int i = m.count - 1; i > 0; --i )
+            {
+                p.squares[ i ] = static_cast< int16_t >( idx & 63 );
+                idx >>= 6;
+            }
+
+            p.squares[ 0 ] = static_cast< int16_t >( ( idx / 4 ) * 8 + idx % 4 );
+
+            return p;
+        }
+
+        /*
+            No two pieces on a square, no pawn where it would have promoted or could never have been, and
+            the side that just moved not in check, which no legal move leaves it
+        */
+        static bool isValid( Material const& m, Placement const& p )
+        {
+            for ( int i = 0; i < m.count; ++i )
+            {
+                if ( m.pieces[ i ].type == piece::Type::Pawn && ( p.squares[ i ] < 8 || p.squares[ i ] >= 56 ) )
+                    return false;
+
+                for ( int j = 0; j < i; ++j )
+                {
+                    if ( p.squares[ i ] == p.squares[ j ] )
+                        return false;
+                }
+            }
+
+            bitboard::Boards b;
+
+            for ( int i = 0; i < m.count; ++i )
+            {
+                b.toggle( m.pieces[ i ], p.squares[ i ] );
+            }
+
+            return !bitboard::isAttacked( b, bitboard::first( b.of( !p.aiToMove, piece::Type::King ) ), p.aiToMove );
+        }
+
+        static std::array< Piece, 64 > toBoard( Material const& m, Squares const& squares )
+        {
+            std::array< Piece, 64 > board;
+            board.fill( Piece{} );
+
+            for ( int i = 0; i < m.count; ++i )
+            {
+                board[ squares[ i ] ] = m.pieces[ i ];
+            }
+
+            return board;
+        }
+
+        /*
+            Calls fn( index ) for each position with the other side to move that reaches this one by a
+            move that neither captures nor promotes, so stays in the same table. Both this placement and
+            its mirror image are undone, as either may have been reached from a stored position.
+        */
+        template< class Fn >
+        static void forEachPredecessor( Material const& m, Placement const& p, Fn fn )
+        {
+            auto const moverIsAi = !p.aiToMove;
+
+            for ( int16_t const mirror : { 0, 7 } )
+            {
+                Squares squares = p.squares;
+
+                for ( int i = 0; i < m.count; ++i )
+                {
+                    squares[ i ] ^= mirror;
+                }
+
+                auto const board = toBoard( m, squares );
+
+                auto const unmove = [&]( int piece, int16_t from )
+                {
+                    Placement before = { squares, moverIsAi };
+                    before.squares[ piece ] = from;
+
+                    // the mirror image of a stored position isn't stored itself, and one the mover couldn't have been left in isn't reached
+                    if ( ( before.squares[ 0 ] & 7 ) < 4 && isValid( m, before ) )
+                        fn( tablebase::index( m, before.squares, moverIsAi ) );
+                };
+
+                for ( int i = 0; i < m.count; ++i )
+                {
+                    auto const piece = m.pieces[ i ];
+
+                    if ( piece.isAi() != moverIsAi )
+                        continue;
+
+                    auto const to = squares[ i ];
+
+                    if ( piece.type == piece::Type::Pawn )
+                    {
+                        auto const forward = moverIsAi ? 8 : -8;
+                        auto const from = static_cast< int16_t >( to - forward );
+
+                        if ( from < 8 || from >= 56 || !board[ from ].isNull() )
+                            continue;
+
+                        unmove( i, from );
+
+                        auto const doubleFrom = static_cast< int16_t >( from - forward );
+
+                        if ( board::isPawnStartingPosition( doubleFrom, moverIsAi ) && board[ doubleFrom ].isNull() )
+                            unmove( i, doubleFrom );
+
+                        continue;
+                    }
+
+                    // every piece but the pawn can go back the way it came
+                    auto [begin, end] = move::getMovesForPieceType( piece.type );
+
+                    for ( ; begin != end; ++begin )
+                    {
+                        auto const coords = board::indexToCoords( to );
+
+                        for ( int16_t d = 1; d <= begin->maxDistance; ++d )
+                        {
+                            auto const from = coords + begin->direction * d;
+
+                            if ( board::isOutOfBounds( from ) || !board[ board::coordsToIndex( from ) ].isNull() )
+                                break;
+
+                            unmove( i, board::coordsToIndex( from ) );
+                        }
+                    }
+                }
+            }
+        }
+
+        struct ThreadOutput
+        {
+            std::vector< uint32_t > decided;
+            std::array< std::vector< uint32_t >, 2 * MaxPlies + 2 > wins;
+            std::array< std::vector< uint32_t >, 2 * MaxPlies + 2 > losses;
+        };
+
+        bool build( Material const& m )
+        {
+            auto const before = std::chrono::steady_clock::now();
+            auto const size = 2 * m.placements();
+
+            auto values = std::make_unique< std::vector< int8_t > >( size, 0 );
+            // moves that stay in this table and haven't been found to lose yet
+            std::vector< uint8_t > remaining( size, 0 );
+            // the longest a position can lose in through a capture or promotion, or -1 if it can't lose
+            std::vector< int16_t > lossAt( size, -1 );
+
+            std::vector< ThreadOutput > outputs( m_threads );
+            std::atomic< bool > missingTable = false;
+
+            // forward pass: count each position's moves and settle everything that leaves the table
+            parallelFor( size, m_threads, [&]( uint64_t begin, uint64_t end, int thread )
+            {
+                auto& out = outputs[ thread ];
+
+                for ( auto idx = begin; idx < end; ++idx )
+                {
+                    auto const p = decode( m, idx );
+
+                    if ( !isValid( m, p ) )
+                        continue;
+
+                    auto board = toBoard( m, p.squares );
+                    auto const pos = Position::fromBoard( board.data(), p.aiToMove );
+
+                    MoveList moves;
+                    ai::details::generateMoves( pos, moves );
+
+                    // checkmate, or stalemate, which stays a draw
+                    if ( moves.empty() )
+                    {
+                        if ( pos.isInCheck( p.aiToMove ) )
+                            out.losses[ 1 ].push_back( static_cast< uint32_t >( idx ) );
+
+                        continue;
+                    }
+
+                    int winIn = 0;
+                    int lossIn = 0;
+                    auto canLose = true;
+
+                    for ( auto const& [move, _] : moves )
+                    {
+                        if ( !move.isCapture() && !move.isPromotion() )
+                        {
+                            remaining[ idx ] += 1;
+                            continue;
+                        }
+
+                        auto child = board;
+                        board::movePiece( child.data(), move.from(), move.dst(), move.promotion() );
+
+                        auto const value = m_tables.probe( child.data(), !p.aiToMove );
+
+                        if ( !value )
+                        {
+                            missingTable = true;
+                            continue;
+                        }
+
+                        if ( *value < 0 )
+                            winIn = winIn ? std::min( winIn, 1 - *value ) : 1 - *value;
+                        else if ( *value > 0 )
+                            lossIn = std::max( lossIn, 1 + *value );
+                        else
+                            canLose = false;
+                    }
+
+                    if ( winIn )
+                    {
+                        out.wins[ winIn ].push_back( static_cast< uint32_t >( idx ) );
+                    }
+                    else if ( canLose )
+                    {
+                        lossAt[ idx ] = static_cast< int16_t >( lossIn );
+
+                        if ( remaining[ idx ] == 0 )
+                            out.losses[ lossIn ].push_back( static_cast< uint32_t >( idx ) );
+                    }
+                }
+            } );
+
+            if ( missingTable )
+            {
+                std::cerr << m.name() << ": a capture or promotion leads to a table that wasn't generated\n";
+                return false;
+            }
+
+            std::array< std::vector< uint32_t >, 2 * MaxPlies + 2 > wins;
+            std::array< std::vector< uint32_t >, 2 * MaxPlies + 2 > losses;
+
+            auto const gather = [&]
+            {
+                for ( auto& out : outputs )
+                {
+                    for ( size_t d = 0; d < wins.size(); ++d )
+                    {
+                        wins[ d ].insert( wins[ d ].end(), out.wins[ d ].begin(), out.wins[ d ].end() );
+                        losses[ d ].insert( losses[ d ].end(), out.losses[ d ].begin(), out.losses[ d ].end() );
+                        out.wins[ d ].clear();
+                        out.losses[ d ].clear();
+                    }
+                }
+            };
+
+            gather();
+
+            auto const claim = [&values]( uint32_t idx, int8_t value )
+            {
+                int8_t undecided = 0;
+                return std::atomic_ref< int8_t >( ( *values )[ idx ] ).compare_exchange_strong( undecided, value );
+            };
+
+            // backward pass, a ply at a time so every position is settled at its shortest distance
+            std::vector< uint32_t > frontier;
+
+            for ( int ply = 1; ply < static_cast< int >( wins.size() ); ++ply )
+            {
+                auto const pending = [&]
+                {
+                    for ( auto d = ply; d < static_cast< int >( wins.size() ); ++d )
+                    {
+                        if ( !wins[ d ].empty() || !losses[ d ].empty() )
+                            return true;
+                    }
+
+                    return false;
+                };
+
+                if ( frontier.empty() && !pending() )
+                    break;
+
+                if ( ply > MaxPlies )
+                {
+                    std::cerr << m.name() << ": positions take longer than " << MaxPlies << " plies to decide\n";
+                    return false;
+                }
+
+                std::vector< uint32_t > next;
+
+                for ( auto const idx : wins[ ply ] )
+                {
+                    if ( claim( idx, static_cast< int8_t >( ply ) ) )
+                        next.push_back( idx );
+                }
+
+                for ( auto const idx : losses[ ply ] )
+                {
+                    if ( claim( idx, static_cast< int8_t >( -ply ) ) )
+                        next.push_back( idx );
+                }
+
+                parallelFor( frontier.size(), m_threads, [&]( uint64_t begin, uint64_t end, int thread )
+                {
+                    auto& out = outputs[ thread ];
+
+                    for ( auto i = begin; i < end; ++i )
+                    {
+                        auto const idx = frontier[ i ];
+                        auto const lost = ( *values )[ idx ] < 0;
+
+                        forEachPredecessor( m, decode( m, idx ), [&]( uint64_t before )
+                        {
+                            // a move into a lost position wins
+                            if ( lost )
+                            {
+                                if ( claim( static_cast< uint32_t >( before ), static_cast< int8_t >( ply ) ) )
+                                    out.decided.push_back( static_cast< uint32_t >( before ) );
+
+                                return;
+                            }
+
+                            // once every move lets the other side win, this side loses
+                            if ( std::atomic_ref< uint8_t >( remaining[ before ] ).fetch_sub( 1 ) != 1 || lossAt[ before ] < 0 )
+                                return;
+
+                            auto const lossIn = std::max< int >( ply, lossAt[ before ] );
+
+                            if ( lossIn > ply )
+                                out.losses[ lossIn ].push_back( static_cast< uint32_t >( before ) );
+                            else if ( claim( static_cast< uint32_t >( before ), static_cast< int8_t >( -ply ) ) )
+                                out.decided.push_back( static_cast< uint32_t >( before ) );
+                        } );
+                    }
+                } );
+
+                for ( auto& out : outputs )
+                {
+                    next.insert( next.end(), out.decided.begin(), out.decided.end() );
+                    out.decided.clear();
+                }
+
+                gather();
+
+                frontier = std::move( next );
+            }
+
+            m_tables.add( m, *values );
+
+            if ( !verify( m ) )
+                return false;
+
+            if ( !write( m, *values ) )
+                return false;
+
+            m_done.push_back( m );
+            m_values.push_back( std::move( values ) );
+
+            std::chrono::duration< double > const seconds = std::chrono::steady_clock::now() - before;
+            std::cout << m.name() << ": " << size << " positions in " << seconds.count() << "s\n";
+
+            return true;
+        }
+
+        // Checks every position against its moves with a plain one ply search over the finished table
+        bool verify( Material const& m ) const
+        {
+            std::atomic< uint64_t > wrong = 0;
+
+            parallelFor( 2 * m.placements(), m_threads, [&]( uint64_t begin, uint64_t end, int )
+            {
+                for ( auto idx = begin; idx < end; ++idx )
+                {
+                    auto const p = decode( m, idx );
+
+                    if ( !isValid( m, p ) )
+                        continue;
+
+                    auto board = toBoard( m, p.squares );
+                    auto const pos = Position::fromBoard( board.data(), p.aiToMove );
+
+                    MoveList moves;
+                    ai::details::generateMoves( pos, moves );
+
+                    auto best = moves.empty() ? ( pos.isInCheck( p.aiToMove ) ? tablebase::toScore( -1 ) : 0 ) : std::numeric_limits< int >::min();
+
+                    for ( auto const& [move, _] : moves )
+                    {
+                        auto child = board;
+                        board::movePiece( child.data(), move.from(), move.dst(), move.promotion() );
+
+                        auto const value = m_tables.probe( child.data(), !p.aiToMove );
+                        // a ply further from the end than the child
+                        auto const score = !value || *value == 0 ? 0 : -tablebase::toScore( *value ) + ( *value > 0 ? 1 : -1 );
+
+                        best = std::max( best, score );
+                    }
+
+                    if ( best != tablebase::toScore( *m_tables.probe( board.data(), p.aiToMove ) ) )
+                        wrong += 1;
+                }
+            } );
+
+            if ( wrong != 0 )
+                std::cerr << m.name() << ": " << wrong << " positions disagree with their moves\n";
+
+            return wrong == 0;
+        }
+
+        bool write( Material const& m, std::vector< int8_t > const& values ) const
+        {
+            tablebase::Header header{};
+            std::copy( std::begin( tablebase::Magic ), std::end( tablebase::Magic ), header.magic );
+            header.pieceCount = static_cast< uint8_t >( m.count );
+
+            for ( int i = 0; i < m.count; ++i )
+            {
+                header.pieces[ i ] = static_cast< uint8_t >( m.pieces[ i ].type | m.pieces[ i ].isAi() << 3 );
+            }
+
+            auto const path = m_directory / ( m.name() + ".ctb" );
+            std::ofstream out( path, std::ios::binary );
+
+            out.write( reinterpret_cast< const char* >( &header ), sizeof( header ) );
+            out.write( reinterpret_cast< const char* >( values.data() ), static_cast< std::streamsize >( values.size() ) );
+
+            if ( !out )
+                std::cerr << "Couldn't write " << path << "\n";
+
+            return static_cast< bool >( out );
+        }
+
+        std::filesystem::path m_directory;
+        int m_threads;
+        std::vector< Material > m_done;
+        std::vector< std::unique_ptr< std::vector< int8_t > > > m_values;
+        tablebase::Tablebases m_tables;
+    };
+}
+
+int main( int argc, char** argv )
+{
+    int threads = std::max( 1u, std::thread::hardware_concurrency() );
+    std::vector< std::string_view > args;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        auto const arg = std::string_view( argv[ i ] );
+
+        if ( arg == "--threads" && i + 1 < argc )
+        {
+            threads = std::max( 1, std::atoi( argv[ ++i ] ) );
+        }
+        else
+        {
+            args.push_back( arg );
+        }
+    }
+
+    if ( args.empty() )
+    {
+        std::cerr << "usage: tbgen [--threads N] <output directory> [tables...]\n";
+        return 1;
+    }
+
+    std::filesystem::path const directory( args[ 0 ] );
+    std::filesystem::create_directories( directory );
+
+    std::vector< std::string_view > names( args.begin() + 1, args.end() );
+
+    if ( names.empty() )
+        names = { "KQvK", "KRvK", "KPvK", "KBNvK" };
+
+    Generator generator( directory, threads );
+
+    for ( auto const name : names )
+    {
+        auto const m = Material::fromName( name );
+
+        if ( !m )
+        {
+            std::cerr << name << " isn't a table: up to " << tablebase::MaxPieces << " pieces, one king each, in the order KQBNRP\n";
+            return 1;
+        }
+
+        if ( !generator.generate( *m ) )
+            return 1;
+    }
+
+    return 0;
+}